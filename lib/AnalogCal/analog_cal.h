@@ -0,0 +1,73 @@
+/*
+
+  batee.com 90-96 Analog Cal IC Tester - Measurement Pipeline
+
+  Turns the raw ADC counts of one measurement cycle into resistances and a
+  verdict.  Nothing in here touches the hardware, so the same code runs in the
+  firmware and in the native benchmark under test/.
+
+*/
+
+#ifndef ANALOG_CAL_H
+#define ANALOG_CAL_H
+
+#include <stdint.h>
+
+// Every ADC channel we read, in the order the firmware reads them
+enum channel_index { CH_VIN, CH_VTEST, CH_R1, CH_R2, CH_R3, CH_R4, CH_R5, CH_R6, CH_COUNT };
+
+// Both ADS1115s run at GAIN_ONE: +/- 4.096V over 16 bits.  Must match ads.setGain() in setup().
+#define ADC_VOLTS_PER_COUNT (4.096f / 32768)
+
+// ADC count limits for open / shorted resistors
+#define ADC_OPEN_COUNTS 29500 // Above this the divider is floating - resistor is open
+#define ADC_SHORT_COUNTS 3277 // Below this the divider is pulled to ground - resistor is shorted
+
+// DUT Resistors
+#define NUM_DUT_RESISTORS 6
+#define R4_INDEX 3
+
+struct dut_resistor {
+  uint8_t channel; // Which entry of the acquisition sequence measures this resistor
+  float test_resistor; // in kOhms as measured from ground to the DUT Socket pin
+  float desired; // in kOhms, this is the value we install on the ICs
+  float tolerance_reference; // in kOhms, the value the measurement has to be within 1% of
+  const char *name;
+  const char *format; // Used to print the measured and target values
+};
+
+extern const dut_resistor dut_resistors[NUM_DUT_RESISTORS];
+
+extern const float R4_desired_1; // in kOhms, 6K model
+extern const float R4_desired_2; // in kOhms, 8K model
+
+extern const float VIN_divider; // VIN = VIN_divider * U5_AIN2 - actual measured value
+extern const float VTEST_divider; // VTEST = VTEST_divider * U5_AIN0 - actual measured value
+
+enum resistor_state { RES_VALUE, RES_OPEN, RES_SHORT };
+
+// Everything we learned about the DUT in one measurement cycle
+struct measurement {
+  int16_t counts[CH_COUNT]; // Actual count measured by the ADC
+  float VIN, VTEST; // Calculated values of measured voltages with voltage dividers factored in
+  float TEMP;
+  float resistance[NUM_DUT_RESISTORS]; // Calculated value of the resistors under test
+  resistor_state state[NUM_DUT_RESISTORS];
+  bool in_tolerance[NUM_DUT_RESISTORS];
+  int model; // Which model did we detect?  6=6k, 8=8k, 0 = not close to either
+  float model_value;
+  bool pass; // every resistor present and within tolerance
+  uint32_t duration_ms; // How long the cycle took from first conversion to last
+};
+
+// The stages of the pipeline, in the order evaluate_measurement() runs them.
+// They are separate so the benchmark can time each one.
+void compute_resistances(const int16_t *counts, measurement &m);
+void detect_open_short(measurement &m);
+void classify_model(measurement &m);
+void check_tolerance(measurement &m);
+
+// Run the whole pipeline on the raw counts of one cycle
+void evaluate_measurement(const int16_t *counts, float temperature, measurement &m);
+
+#endif
@@ -0,0 +1,110 @@
+/*
+
+  batee.com 90-96 Analog Cal IC Tester - Fixture Health
+
+*/
+
+#include "fixture_health.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+
+const relay_pair relay_pairs[NUM_RELAYS] = {
+  { { CH_R2, CH_R3 }, FIXTURE_RELAY1 },
+  { { CH_R1, CH_R5 }, FIXTURE_RELAY2 },
+  { { CH_R4, CH_R6 }, FIXTURE_RELAY3 },
+};
+
+
+uint8_t check_supplies(float VIN, float VTEST)
+{
+  uint8_t faults = 0;
+
+  if (VIN < VIN_MIN) {
+    faults |= FIXTURE_VIN_LOW;
+  } else if (VIN > VIN_MAX) {
+    faults |= FIXTURE_VIN_HIGH;
+  }
+  if (VTEST < VTEST_MIN) {
+    faults |= FIXTURE_VTEST_LOW;
+  } else if (VTEST > VTEST_MAX) {
+    faults |= FIXTURE_VTEST_HIGH;
+  }
+  return faults;
+}
+
+
+bool check_empty_socket(const int16_t *counts, uint8_t &low_pairs)
+{
+  low_pairs = 0;
+  for (int r = 0; r < NUM_RELAYS; r++)
+  {
+    for (int c = 0; c < 2; c++)
+    {
+      int16_t adc = counts[relay_pairs[r].channels[c]];
+      if (adc >= ADC_SHORT_COUNTS && adc <= ADC_OPEN_COUNTS) {
+        return false; // A resistance - there is a DUT in the socket
+      }
+      if (adc < ADC_SHORT_COUNTS) {
+        low_pairs |= relay_pairs[r].fault;
+      }
+    }
+  }
+  return true;
+}
+
+
+uint8_t open_relay_pairs(const int16_t *counts)
+{
+  uint8_t open_pairs = 0;
+  for (int r = 0; r < NUM_RELAYS; r++)
+  {
+    if (counts[relay_pairs[r].channels[0]] > ADC_OPEN_COUNTS && counts[relay_pairs[r].channels[1]] > ADC_OPEN_COUNTS) {
+      open_pairs |= relay_pairs[r].fault;
+    }
+  }
+  return open_pairs;
+}
+
+
+bool socket_occupied(const int16_t *counts, uint8_t dead_paths)
+{
+  return (FIXTURE_RELAY_FAULTS & ~open_relay_pairs(counts) & ~dead_paths) != 0;
+}
+
+
+uint8_t check_baseline_drift(float VIN, float VTEST, const int16_t *zero_counts, const fixture_baseline &baseline)
+{
+  if (fabsf(VIN - baseline.VIN) > VIN_DRIFT_LIMIT * baseline.VIN) {
+    return FIXTURE_DRIFT;
+  }
+  if (fabsf(VTEST - baseline.VTEST) > VTEST_DRIFT_LIMIT * baseline.VTEST) {
+    return FIXTURE_DRIFT;
+  }
+  if (zero_counts != NULL) {
+    for (int i = 0; i < NUM_DUT_RESISTORS; i++)
+    {
+      uint8_t channel = dut_resistors[i].channel;
+      if (zero_counts[channel] - baseline.zero_counts[channel] > ZERO_DRIFT_COUNTS) {
+        return FIXTURE_DRIFT;
+      }
+    }
+  }
+  return 0;
+}
+
+
+void describe_fixture_faults(uint8_t faults, char *text, size_t size)
+{
+  static const char *names[8] = { "VIN LOW", "VIN HIGH", "VTEST LOW", "VTEST HIGH", "RELAY1", "RELAY2", "RELAY3", "DRIFT" };
+  size_t used = 0;
+
+  text[0] = '\0';
+  for (int bit = 0; bit < 8; bit++)
+  {
+    if ((faults & (1 << bit)) && used < size) {
+      used += snprintf(text + used, size - used, "%s%s", used ? " " : "", names[bit]);
+    }
+  }
+}
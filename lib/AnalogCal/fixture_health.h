@@ -0,0 +1,84 @@
+/*
+
+  batee.com 90-96 Analog Cal IC Tester - Fixture Health
+
+  Limits and baseline comparisons for the fixture self-test.  The firmware does
+  the relay switching and stores the baseline in NVS, the decisions are made here.
+
+*/
+
+#ifndef FIXTURE_HEALTH_H
+#define FIXTURE_HEALTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "analog_cal.h"
+
+// Absolute limits.  VIN is the GS90 15V less the drop across D1, VTEST is the R78E5.0 output.
+#define VIN_MIN 13.5f
+#define VIN_MAX 15.5f
+#define VTEST_MIN 4.85f
+#define VTEST_MAX 5.15f
+
+// How far the fixture may drift from its baseline before we warn about it
+#define VIN_DRIFT_LIMIT 0.03f // fraction of the baseline VIN
+#define VTEST_DRIFT_LIMIT 0.005f // fraction of the baseline VTEST.  Every resistance scales with VTEST so this one is tight.
+#define ZERO_DRIFT_COUNTS 40 // 5mV - a channel reading this far above its baseline with the relay off is leaking
+
+// Fault bits
+#define FIXTURE_VIN_LOW (1 << 0)
+#define FIXTURE_VIN_HIGH (1 << 1)
+#define FIXTURE_VTEST_LOW (1 << 2)
+#define FIXTURE_VTEST_HIGH (1 << 3)
+#define FIXTURE_RELAY1 (1 << 4) // Relay1 path (R2 and R3) didn't switch
+#define FIXTURE_RELAY2 (1 << 5) // Relay2 path (R1 and R5) didn't switch
+#define FIXTURE_RELAY3 (1 << 6) // Relay3 path (R4 and R6) didn't switch
+#define FIXTURE_DRIFT (1 << 7) // Moved away from the baseline, but still inside the absolute limits
+
+#define FIXTURE_SUPPLY_FAULTS (FIXTURE_VIN_LOW | FIXTURE_VIN_HIGH | FIXTURE_VTEST_LOW | FIXTURE_VTEST_HIGH)
+#define FIXTURE_RELAY_FAULTS (FIXTURE_RELAY1 | FIXTURE_RELAY2 | FIXTURE_RELAY3)
+// With any of these set the readings can't be trusted, so DUTs aren't counted in the lot
+#define FIXTURE_BLOCKING_FAULTS (FIXTURE_SUPPLY_FAULTS | FIXTURE_RELAY_FAULTS)
+
+// Which resistor channels each relay powers, Relay1 to Relay3
+#define NUM_RELAYS 3
+
+struct relay_pair {
+  uint8_t channels[2];
+  uint8_t fault; // FIXTURE_RELAYn
+};
+
+extern const relay_pair relay_pairs[NUM_RELAYS];
+
+#define FIXTURE_BASELINE_VERSION 1
+
+// What a healthy fixture looked like, cached in NVS
+struct fixture_baseline {
+  uint32_t version; // FIXTURE_BASELINE_VERSION
+  float VIN, VTEST;
+  int16_t zero_counts[CH_COUNT]; // Resistor channels with their relay off and the socket empty
+};
+
+// Returns the FIXTURE_SUPPLY_FAULTS bits for these supply voltages
+uint8_t check_supplies(float VIN, float VTEST);
+
+// Looks at the resistor channels read with every relay on.  Returns false if some channel reads a
+// resistance - there is a DUT in the socket.  Otherwise low_pairs gets the FIXTURE_RELAYn bits of the
+// pairs that read Short instead of open.  That is a dead path (relay stuck open, broken trace or socket
+// pin), but it is also a part with only shorted pins, or one caught half way in.  Only switching the
+// relays, and seeing it persist, tells them apart.
+bool check_empty_socket(const int16_t *counts, uint8_t &low_pairs);
+
+// FIXTURE_RELAYn bits of the pairs whose channels both read open.  Their paths work.
+uint8_t open_relay_pairs(const int16_t *counts);
+
+// Is there a DUT in the socket?  Any channel not reading open, on a pair that isn't in dead_paths.
+bool socket_occupied(const int16_t *counts, uint8_t dead_paths);
+
+// Returns FIXTURE_DRIFT if the supplies, or the zero counts when given, moved away from the baseline
+uint8_t check_baseline_drift(float VIN, float VTEST, const int16_t *zero_counts, const fixture_baseline &baseline);
+
+// Short text naming the faults, for the display
+void describe_fixture_faults(uint8_t faults, char *text, size_t size);
+
+#endif
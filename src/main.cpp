@@ -1,10 +1,10 @@
 /*
 
-  batee.com 90-96 Analog Cal IC Tester 
-  
-  Hardware: v2.2.1 
-  
-  Firmware: 1.0.0
+  batee.com 90-96 Analog Cal IC Tester
+
+  Hardware: v2.2.1
+
+  Firmware: 1.1.0
 
   by Bryan A. "CrazyUncleBurton" Thompson
 
@@ -16,25 +16,207 @@
 // Includes
 #include <Arduino.h>
 #include <M5Core2.h> // Board Support File for M5Stack Core2
-#include <Wire.h>  // For external ADC and temperature sensors on I2C bus
+#include <Wire.h>  // For external ADC and temperature sensors on I2C bus (Wire1, shared with the touch panel and AXP192)
 #include "Free_Fonts.h"  // Include the header file attached to this sketch
 #include <Adafruit_ADS1X15.h>
+#include <analog_cal.h> // Measurement pipeline, shared with the native benchmark
+#include <esp_sleep.h> // Light sleep while the tester is idle
+#include <Preferences.h> // NVS, for the fixture baseline
+#include <fixture_health.h> // Fixture self-test limits and baseline checks
 
 // Project Specific Pinouts
-#define RELAY1_CONTROL G19  // G19 (Resistors R2 and R3) 
+#define RELAY1_CONTROL G19  // G19 (Resistors R2 and R3)
 #define RELAY2_CONTROL G26  // G26 (Resistors R1 and R5)
 #define RELAY3_CONTROL G25  // G25 (Resistors R4 and R6)
+#define TOUCH_INT GPIO_NUM_39  // G39 FT6336U touch interrupt, low while the panel is touched
 
 // I2C Addresses
 #define ADS1115_U5 0x48 // I2C Address for ADS1115 ADC #1
 #define ADS1115_U6 0x4a // I2C Address for ADS1115 ADC #2
 #define Temperature_Sensor_Address 0x4D   //I2C address of MCP9802 Temperature Sensor
 
+// Timing
+#define MEASURE_INTERVAL_MS 500 // Time between the start of two measurement cycles (was the delay(500) at the end of loop())
+#define DUT_SETTLE_CYCLES 2 // A DUT must be seen this many cycles in a row before it is counted in the lot statistics
+
+// Mains-synchronous sampling
+// Each channel is read as a burst of fast conversions spread evenly over whole mains cycles and
+// averaged.  Hum from the GS90 and the bench integrates to zero over a whole cycle, so we get a
+// quiet reading at 860SPS instead of having to run the ADCs slowly.
+#define MAINS_HZ 60 // 50 or 60 - line frequency where the tester is used
+#define MAINS_CYCLES_PER_BURST 2 // More cycles per burst = more averaging, slower cycle.  Change BURST_SAMPLES with it.
+// BURST_SAMPLES are spread evenly over the MAINS_CYCLES_PER_BURST cycles.  Keep the two coprime:
+// then every sample lands on a different phase of the cycle, BURST_SAMPLES phases evenly spaced,
+// and the line frequency and all its harmonics below the BURST_SAMPLES-th average out.  (4 samples
+// over 2 cycles would just take the same 4 phases twice.)  7 over 2 nulls up to the 6th harmonic.
+// Timing budget per sample, both lanes, 400kHz bus: one config write each (~0.1ms), the 860SPS
+// conversion itself (1.16ms, up to ~1.3ms on the ADS1115's internal oscillator), then one status
+// poll and one result read each (~0.25ms).  About 1.9ms, plus up to ~1ms for a touch panel read
+// and the rest of loop().  7 samples over 2 cycles gives 4762us at 60Hz / 5714us at 50Hz, with room.
+#define BURST_SAMPLES 7
+#define SAMPLE_SPACING_US (MAINS_CYCLES_PER_BURST * 1000000UL / (MAINS_HZ * BURST_SAMPLES))
+#define ADS1115_CONVERSION_US 1300 // 1/860SPS plus 10% for the internal oscillator - don't poll before this
+
+// Idle power management
+#define IDLE_TIMEOUT_MS (5 * 60 * 1000UL) // Go idle after this long with no touches and an empty socket
+#define IDLE_DUT_POLL_MS 500 // While idle, wake up this often to look for a DUT.  This is the worst case wake latency on insertion.
+#define RELAY_SETTLE_MS 10 // Time for a relay to switch and the dividers to settle before we read them
+#define WAKE_SETTLE_MS 200 // Time for the test resistors to settle after the relays come back on
+#define LCD_ACTIVE_VOLTAGE 3300 // AXP192 DCDC3 backlight voltage in mV, 3300 is full brightness
+#define LCD_IDLE_VOLTAGE 2500 // AXP192 DCDC3 backlight voltage in mV while idle, 2500 is the dimmest that is still readable
+
+// Fixture self-test
+#define FIXTURE_CHECK_INTERVAL_MS (10 * 60 * 1000UL) // Re-check the relay paths this often, whenever the socket is empty
+#define BASELINE_HOLD_MS 3000 // Hold Re-test this long on the Diagnostics page to save the fixture as the new baseline
+#define DEAD_PATH_CYCLES 10 // A pair reading Short with nothing else in the socket this many cycles in a row gets the relays switched
+
+// Display layout.  Rows of text fill the top of the screen, the touch buttons sit in a strip underneath.
+#define DISPLAY_ROWS 7
+#define ROW_HEIGHT 28
+#define BUTTON_STRIP_Y 200
+#define BUTTON_HEIGHT 38
+#define BUTTON_WIDTH 100
+
 
 // Instantiations
 Adafruit_ADS1115 ads;  /* U5 - Use this for the 16-bit version */
 Adafruit_ADS1115 ads2;  /* U6 - Use this for the 16-bit version */
 
+// On-screen touch buttons.  M5.BtnA/B/C (the three red circles under the screen) do the same thing.
+ButtonColors button_off_colors = {TFT_DARKGREY, TFT_WHITE, TFT_WHITE};
+ButtonColors button_on_colors = {TFT_WHITE, TFT_BLACK, TFT_WHITE};
+Button page_button(4, BUTTON_STRIP_Y, BUTTON_WIDTH, BUTTON_HEIGHT, false, "Page", button_off_colors, button_on_colors);
+Button retest_button(110, BUTTON_STRIP_Y, BUTTON_WIDTH, BUTTON_HEIGHT, false, "Re-test", button_off_colors, button_on_colors);
+Button lot_button(216, BUTTON_STRIP_Y, BUTTON_WIDTH, BUTTON_HEIGHT, false, "New Lot", button_off_colors, button_on_colors);
+
+
+// Acquisition sequence
+// U5 and U6 convert in parallel, each working through its own four channels one burst at a time.
+// Conversions are started and polled from loop(), so the touch panel keeps getting serviced
+// while the ADCs convert instead of waiting inside readADC_SingleEnded().
+#define ACQ_SLOTS 4
+
+struct adc_channel {
+  uint8_t channel; // channel_index this is stored as
+  uint16_t mux;
+};
+
+struct adc_lane {
+  Adafruit_ADS1115 *adc;
+  uint8_t address; // The bursts talk to the ADS1115 directly, see ads_start_single()
+  adc_channel slots[ACQ_SLOTS];
+};
+
+const adc_lane acquisition_lanes[2] = {
+  { &ads, ADS1115_U5, {
+    { CH_VIN,   ADS1X15_REG_CONFIG_MUX_SINGLE_2 }, // U5_AIN2 - 15V0 Power In Voltage
+    { CH_VTEST, ADS1X15_REG_CONFIG_MUX_SINGLE_0 }, // U5_AIN0 - 5V0 Test Voltage
+    { CH_R4,    ADS1X15_REG_CONFIG_MUX_SINGLE_3 }, // U5_AIN3 - DUT_R4
+    { CH_R6,    ADS1X15_REG_CONFIG_MUX_SINGLE_1 }, // U5_AIN1 - DUT_R6
+  } },
+  { &ads2, ADS1115_U6, {
+    { CH_R1,    ADS1X15_REG_CONFIG_MUX_SINGLE_2 }, // U6_AIN2 - DUT_R1
+    { CH_R2,    ADS1X15_REG_CONFIG_MUX_SINGLE_0 }, // U6_AIN0 - DUT_R2
+    { CH_R3,    ADS1X15_REG_CONFIG_MUX_SINGLE_1 }, // U6_AIN1 - DUT_R3
+    { CH_R5,    ADS1X15_REG_CONFIG_MUX_SINGLE_3 }, // U6_AIN3 - DUT_R5
+  } },
+};
+
+// Where each lane is in the current burst
+struct lane_state {
+  uint8_t sample; // Samples finished so far
+  bool converting;
+  uint32_t start_us; // When the conversion in flight was started
+  int32_t sum;
+};
+
+// Relay control pins, in the same order as relay_pairs in fixture_health
+const uint8_t relay_pins[NUM_RELAYS] = { RELAY1_CONTROL, RELAY2_CONTROL, RELAY3_CONTROL };
+
+// Lot statistics shown on the Stats page
+struct lot_statistics {
+  uint32_t tested;
+  uint32_t passed;
+  uint32_t failed;
+  uint32_t model_6k;
+  uint32_t model_8k;
+  uint32_t resistor_fails[NUM_DUT_RESISTORS];
+};
+
+
+// Pages the Page button cycles through
+enum display_page { PAGE_RESULTS, PAGE_STATS, PAGE_DIAGNOSTICS, PAGE_COUNT };
+
+// Acquisition state
+enum acquisition_state { ACQ_IDLE, ACQ_CONVERTING };
+acquisition_state acq_state = ACQ_IDLE;
+uint8_t acq_slot = 0;
+uint32_t acq_cycle_start = 0;
+uint32_t burst_start_us = 0;
+lane_state lanes[2];
+int16_t acq_counts[CH_COUNT];
+uint32_t sample_late_max_us = 0; // Worst case a burst sample started after its slot - shows how much the loop jitters the sampling
+uint32_t i2c_errors = 0; // ADC reads that weren't answered and had to be retried
+
+measurement last_measurement;
+bool have_measurement = false;
+uint32_t cycle_count = 0;
+
+// Lot tracking
+lot_statistics lot;
+bool dut_recorded = false; // Has the DUT in the socket already been counted?
+uint8_t dut_settle = 0;
+measurement recorded_measurement; // What we counted for the DUT in the socket, so a re-test can take it back
+bool dut_from_old_lot = false; // The DUT in the socket was counted before New Lot, it isn't in this lot's numbers
+
+// Fixture health
+// The supplies are checked against their limits every cycle from the burst readings.  The relay
+// paths are checked by the self-test at boot and every FIXTURE_CHECK_INTERVAL_MS with the socket empty.
+enum selftest_state { ST_IDLE, ST_SUPPLIES, ST_RELAY_OFF, ST_ZERO_BURST, ST_RELAY_ON };
+selftest_state st_state = ST_IDLE;
+uint8_t st_relay = 0;
+uint32_t st_wait_start = 0;
+float st_VIN, st_VTEST;
+int16_t st_zero_counts[CH_COUNT];
+uint8_t st_relay_faults = 0;
+uint8_t st_dead_paths = 0;
+uint8_t st_burst_channel = 0; // Which channel of the pair the zero-count burst is on
+lane_state st_burst;
+uint32_t st_burst_start_us = 0;
+bool selftest_requested = false;
+bool selftest_save_baseline = false; // Save the result as the new baseline if it passes
+uint32_t last_selftest_ms = 0;
+uint32_t last_selftest_cycle = 0;
+uint32_t st_seen_cycle = 0; // Last cycle the self-test looked at, so it starts right after a fresh one
+
+uint8_t supply_faults = 0; // FIXTURE_SUPPLY_FAULTS from the last cycle or self-test
+uint8_t supply_drift = 0; // FIXTURE_DRIFT if VIN / VTEST moved away from the baseline in the last cycle
+uint8_t relay_faults = 0; // FIXTURE_RELAY_FAULTS for relays the last self-test found stuck closed
+uint8_t dead_paths = 0; // FIXTURE_RELAY_FAULTS for pairs the last self-test found dead, until they read open again
+uint8_t low_pair_cycles = 0; // Cycles in a row with a pair reading Short and no DUT resistance anywhere
+uint8_t selftest_drift = 0; // FIXTURE_DRIFT if the last self-test didn't match the baseline
+
+Preferences prefs;
+fixture_baseline baseline;
+bool have_baseline = false;
+
+// Display state
+display_page current_page = PAGE_RESULTS;
+uint8_t render_row = DISPLAY_ROWS; // Next row to draw, DISPLAY_ROWS when the page is up to date
+uint32_t loop_max_ms = 0; // Worst case time between two calls to M5.update() - this is our input latency
+
+// Power state
+bool idle = false;
+uint32_t last_activity_ms = 0; // Last touch or DUT insertion / removal
+uint32_t last_loop_pass = 0;
+
+// Requests from the touch handlers.  Handlers run inside M5.update() and only set these flags,
+// loop() acts on them so the handlers never touch the I2C bus or the ADCs.
+bool page_requested = false;
+bool retest_requested = false;
+bool lot_reset_requested = false;
+bool baseline_requested = false;
+
 
 // Functions
 float get_temperature()
@@ -42,17 +224,17 @@ float get_temperature()
   int TempByte1, TempByte2;
   float TempF=0;
 
-  // MCP9802 Read temperature 
-  Wire.beginTransmission(Temperature_Sensor_Address); // I see this on the capture.
-  Wire.write((byte)0x00); // Address of temperature register - I see this on the capture
-  Wire.endTransmission();
+  // MCP9802 Read temperature
+  Wire1.beginTransmission(Temperature_Sensor_Address); // I see this on the capture.
+  Wire1.write((byte)0x00); // Address of temperature register - I see this on the capture
+  Wire1.endTransmission();
 
   // https://github.com/Koepel/How-to-use-the-Arduino-Wire-library/wiki/Common-mistakes
-  Wire.requestFrom(Temperature_Sensor_Address, 2); // Now read two bytes of temperature data
+  Wire1.requestFrom(Temperature_Sensor_Address, 2); // Now read two bytes of temperature data
 
-  if (Wire.available()) {
-    TempByte1 = Wire.read(); // MSB  Sign/64C/32C/16C/8C/4C/2C/1C
-    TempByte2 = Wire.read(); // LSB  0.5C, 0.25C, 0.125C, 0.0625C, 0, 0, 0, 0
+  if (Wire1.available()) {
+    TempByte1 = Wire1.read(); // MSB  Sign/64C/32C/16C/8C/4C/2C/1C
+    TempByte2 = Wire1.read(); // LSB  0.5C, 0.25C, 0.125C, 0.0625C, 0, 0, 0, 0
     unsigned int Temperature = ((TempByte1 << 8) | TempByte2);
     Temperature = Temperature >> 4;
     float TempC = 1.0 * Temperature * 0.0625;
@@ -60,7 +242,7 @@ float get_temperature()
   } else {
     // Must not have detected a sensor
   }
-  Wire.endTransmission();
+  Wire1.endTransmission();
 
   return TempF;
   // ADC can be read 860 times/sec.  Temp Sensor can be read every 240mS.  So let's slow things down.
@@ -68,10 +250,736 @@ float get_temperature()
 }
 
 
+// Touch handlers - called from M5.update().  Keep these short.
+void on_page_touch(Event& e)
+{
+  page_requested = true;
+}
+
+void on_retest_touch(Event& e)
+{
+  retest_requested = true;
+}
+
+// Re-test held for BASELINE_HOLD_MS
+void on_retest_hold(Event& e)
+{
+  baseline_requested = true;
+}
+
+void on_lot_touch(Event& e)
+{
+  lot_reset_requested = true;
+}
+
+
+uint8_t fixture_faults()
+{
+  return supply_faults | supply_drift | relay_faults | dead_paths | selftest_drift;
+}
+
+
+// An empty socket with a dead relay path reads Short on that pair.  Once the self-test has confirmed
+// the path is dead, that is a fixture fault, not a DUT.
+bool dut_in_socket(const measurement &m)
+{
+  return socket_occupied(m.counts, dead_paths);
+}
+
+
+// Quick check of the fixture, every cycle.  Costs nothing, we already measured everything.
+void check_fixture(const measurement &m)
+{
+  supply_faults = check_supplies(m.VIN, m.VTEST);
+  supply_drift = have_baseline ? check_baseline_drift(m.VIN, m.VTEST, NULL, baseline) : 0;
+
+  // A pair that reads open has a working path, whatever the last self-test said
+  dead_paths &= ~open_relay_pairs(m.counts);
+
+  // A pair reading Short with no resistance anywhere may be a dead path - or a part with only shorted
+  // pins, or one caught on its way in.  Until then it is a DUT, and gets counted.  Only if it stays
+  // that way for DEAD_PATH_CYCLES does the self-test switch the relays and decide.
+  uint8_t low_pairs;
+  if (check_empty_socket(m.counts, low_pairs) && (low_pairs & ~dead_paths)) {
+    if (++low_pair_cycles >= DEAD_PATH_CYCLES) {
+      low_pair_cycles = 0;
+      selftest_requested = true;
+    }
+  } else {
+    low_pair_cycles = 0;
+  }
+}
+
+
+// Add or remove (sign = -1, for a re-test) one DUT from the lot statistics
+void count_in_lot(const measurement &m, int sign)
+{
+  lot.tested += sign;
+  if (m.pass) {
+    lot.passed += sign;
+  } else {
+    lot.failed += sign;
+  }
+  if (m.model == 6) {
+    lot.model_6k += sign;
+  } else if (m.model == 8) {
+    lot.model_8k += sign;
+  }
+  for (int i = 0; i < NUM_DUT_RESISTORS; i++)
+  {
+    if (!m.in_tolerance[i] || m.state[i] != RES_VALUE) {
+      lot.resistor_fails[i] += sign;
+    }
+  }
+}
+
+
+// Count each DUT once, after it has been in the socket for DUT_SETTLE_CYCLES cycles
+void update_lot(const measurement &m)
+{
+  bool present = dut_in_socket(m);
+  if (present != (dut_settle > 0 || dut_recorded)) {
+    last_activity_ms = millis(); // DUT went in or came out
+  }
+  if (!present) {
+    dut_recorded = false;
+    dut_from_old_lot = false;
+    dut_settle = 0;
+    return;
+  }
+  if (fixture_faults() & FIXTURE_BLOCKING_FAULTS) {
+    return; // Can't trust the reading, don't put a false reject in the lot
+  }
+  if (dut_recorded) {
+    return;
+  }
+  if (++dut_settle >= DUT_SETTLE_CYCLES) {
+    count_in_lot(m, 1);
+    recorded_measurement = m;
+    dut_recorded = true;
+  }
+}
+
+
+// Start a single-shot conversion with one config register write.  Adafruit_ADS1X15's
+// startADCReading() also writes both threshold registers every time, which triples the bus
+// traffic.  The comparator is disabled here so the thresholds don't matter.
+void ads_start_single(uint8_t address, uint16_t mux)
+{
+  uint16_t config = ADS1X15_REG_CONFIG_OS_SINGLE | mux | GAIN_ONE | ADS1X15_REG_CONFIG_MODE_SINGLE
+    | RATE_ADS1115_860SPS | ADS1X15_REG_CONFIG_CQUE_NONE;
+  Wire1.beginTransmission(address);
+  Wire1.write((byte)ADS1X15_REG_POINTER_CONFIG);
+  Wire1.write((byte)(config >> 8));
+  Wire1.write((byte)(config & 0xFF));
+  Wire1.endTransmission();
+}
+
+
+// Returns false if the ADC didn't answer.  Wire1.read() would then give -1, which looks like a
+// finished conversion reading -1 counts.
+bool ads_read_register(uint8_t address, uint8_t reg, uint16_t &value)
+{
+  Wire1.beginTransmission(address);
+  Wire1.write(reg);
+  if (Wire1.endTransmission() != 0 || Wire1.requestFrom(address, (uint8_t)2) != 2) {
+    i2c_errors++;
+    return false;
+  }
+  value = Wire1.read() << 8;
+  value |= Wire1.read();
+  return true;
+}
+
+
+// Advance one lane's burst of conversions on mux.  Sample n is due SAMPLE_SPACING_US * n after
+// start_us.  Returns true once all BURST_SAMPLES are in ls.sum.  Never waits on the ADC.
+bool service_burst(uint8_t address, uint16_t mux, lane_state &ls, uint32_t start_us)
+{
+  if (ls.converting) {
+    // Don't spend bus time polling until the conversion can possibly be done.  If the ADC
+    // doesn't answer, try again next pass - the result stays in its conversion register.
+    uint16_t config, result;
+    if (micros() - ls.start_us < ADS1115_CONVERSION_US
+      || !ads_read_register(address, ADS1X15_REG_POINTER_CONFIG, config)
+      || !(config & ADS1X15_REG_CONFIG_OS_NOTBUSY)
+      || !ads_read_register(address, ADS1X15_REG_POINTER_CONVERT, result)) {
+      return false;
+    }
+    ls.sum += (int16_t)result;
+    ls.converting = false;
+    ls.sample++;
+  }
+  if (ls.sample >= BURST_SAMPLES) {
+    return true;
+  }
+
+  uint32_t late = micros() - (start_us + ls.sample * SAMPLE_SPACING_US);
+  if ((int32_t)late >= 0) {
+    if (late > sample_late_max_us) {
+      sample_late_max_us = late;
+    }
+    ls.start_us = micros();
+    ads_start_single(address, mux);
+    ls.converting = true;
+  }
+  return false;
+}
+
+
+void start_burst()
+{
+  burst_start_us = micros();
+  memset(lanes, 0, sizeof(lanes));
+}
+
+
+// Advance the acquisition state machine.  Never waits on the ADCs.
+void service_acquisition()
+{
+  uint32_t now = millis();
+
+  if (acq_state == ACQ_IDLE) {
+    if (st_state != ST_IDLE) {
+      return; // The self-test is switching the relays
+    }
+    if (!retest_requested && (now - acq_cycle_start < MEASURE_INTERVAL_MS)) {
+      return;
+    }
+    retest_requested = false;
+    acq_cycle_start = now;
+    acq_slot = 0;
+    start_burst();
+    acq_state = ACQ_CONVERTING;
+  }
+
+  // ACQ_CONVERTING
+  bool burst_done = true;
+  for (int l = 0; l < 2; l++)
+  {
+    const adc_lane &lane = acquisition_lanes[l];
+    if (!service_burst(lane.address, lane.slots[acq_slot].mux, lanes[l], burst_start_us)) {
+      burst_done = false;
+    }
+  }
+  if (!burst_done) {
+    return;
+  }
+
+  for (int l = 0; l < 2; l++)
+  {
+    acq_counts[acquisition_lanes[l].slots[acq_slot].channel] = (int16_t)lroundf((float)lanes[l].sum / BURST_SAMPLES);
+  }
+
+  if (retest_requested) {
+    // Throw away the partial cycle and start over with the DUT as it is now
+    retest_requested = false;
+    acq_cycle_start = now;
+    acq_slot = 0;
+  } else if (++acq_slot >= ACQ_SLOTS) {
+    // Measure TEMP
+    // For some reason, the first reading is always excessively high.
+    // Read the TEMP twice to work around this problem.
+    float TEMP = get_temperature();
+    if (TEMP > 100)
+    {
+      TEMP = get_temperature();
+    }
+
+    evaluate_measurement(acq_counts, TEMP, last_measurement);
+    last_measurement.duration_ms = now - acq_cycle_start;
+    have_measurement = true;
+    cycle_count++;
+    check_fixture(last_measurement);
+    update_lot(last_measurement);
+    render_row = 0;
+    acq_state = ACQ_IDLE;
+    return;
+  }
+  start_burst();
+}
+
+
+// Which ADC reads this channel, and on which input
+const adc_lane &find_channel(uint8_t channel, uint16_t &mux)
+{
+  for (int l = 0; l < 2; l++)
+  {
+    const adc_lane &lane = acquisition_lanes[l];
+    for (int slot = 0; slot < ACQ_SLOTS; slot++)
+    {
+      if (lane.slots[slot].channel == channel) {
+        mux = lane.slots[slot].mux;
+        return lane;
+      }
+    }
+  }
+  mux = acquisition_lanes[0].slots[0].mux;
+  return acquisition_lanes[0];
+}
+
+
+// One blocking single-shot conversion, about 2ms at 860SPS.  Only for the self-test.
+int16_t read_channel_now(uint8_t channel)
+{
+  uint16_t mux;
+  const adc_lane &lane = find_channel(channel, mux);
+  lane.adc->startADCReading(mux, false);
+  while (!lane.adc->conversionComplete());
+  return lane.adc->getLastConversionResults();
+}
+
+
+void start_zero_burst(uint8_t c)
+{
+  st_burst_channel = c;
+  memset(&st_burst, 0, sizeof(st_burst));
+  st_burst_start_us = micros();
+}
+
+
+void finish_self_test(bool relays_checked)
+{
+  uint32_t now = millis();
+
+  if (relays_checked) {
+    relay_faults = st_relay_faults;
+    dead_paths = st_dead_paths;
+    if ((!have_baseline || selftest_save_baseline) && !(supply_faults | relay_faults | dead_paths)) {
+      // A healthy fixture - this is what we compare against from now on
+      baseline.version = FIXTURE_BASELINE_VERSION;
+      baseline.VIN = st_VIN;
+      baseline.VTEST = st_VTEST;
+      memcpy(baseline.zero_counts, st_zero_counts, sizeof(baseline.zero_counts));
+      prefs.putBytes("baseline", &baseline, sizeof(baseline));
+      have_baseline = true;
+      supply_drift = 0;
+    }
+    selftest_drift = have_baseline ? check_baseline_drift(st_VIN, st_VTEST, st_zero_counts, baseline) : 0;
+    last_selftest_ms = now;
+  } else {
+    // Socket wasn't empty.  Try again as soon as it is.
+    last_selftest_ms = now - FIXTURE_CHECK_INTERVAL_MS;
+  }
+  last_selftest_cycle = cycle_count;
+  selftest_save_baseline = false;
+  st_state = ST_IDLE;
+  render_row = 0;
+}
+
+
+// Fixture self-test.  Each step is a few conversions at most, so loop() keeps servicing the
+// touch panel while the relays settle.
+void service_self_test()
+{
+  uint32_t now = millis();
+
+  switch (st_state) {
+    case ST_IDLE: {
+      if (acq_state != ACQ_IDLE) {
+        return; // Never while the bursts are running
+      }
+      // Only start straight after a cycle.  The supplies and the empty-socket readings are then that
+      // cycle's burst averages - the same numbers every cycle compares against the baseline.
+      bool fresh = have_measurement && cycle_count != st_seen_cycle;
+      st_seen_cycle = cycle_count;
+      if (!fresh) {
+        return;
+      }
+      bool due = !dut_in_socket(last_measurement) && cycle_count != last_selftest_cycle
+        && now - last_selftest_ms >= FIXTURE_CHECK_INTERVAL_MS;
+      if (selftest_requested || due) {
+        selftest_requested = false;
+        st_state = ST_SUPPLIES;
+      }
+      return;
+    }
+
+    case ST_SUPPLIES: {
+      // check_fixture() has already checked these against the limits
+      st_VIN = last_measurement.VIN;
+      st_VTEST = last_measurement.VTEST;
+
+      // The relay paths can only be checked with no resistance in the socket.  Pairs reading Short
+      // get switched like the rest - that is what tells a dead path from a part with shorted pins.
+      uint8_t low_pairs;
+      if (!check_empty_socket(last_measurement.counts, low_pairs)) {
+        finish_self_test(false);
+        return;
+      }
+      st_relay = 0;
+      st_relay_faults = 0;
+      st_dead_paths = 0;
+      digitalWrite (relay_pins[st_relay], LOW);
+      st_wait_start = millis();
+      st_state = ST_RELAY_OFF;
+      return;
+    }
+
+    case ST_RELAY_OFF: {
+      // Relay open - nothing drives the dividers, both channels should read near zero
+      if (now - st_wait_start < RELAY_SETTLE_MS) {
+        return;
+      }
+      start_zero_burst(0);
+      st_state = ST_ZERO_BURST;
+      return;
+    }
+
+    case ST_ZERO_BURST: {
+      // The dividers float with the relay off and pick up hum, so the zero counts that go into the
+      // baseline are burst-averaged over whole mains cycles like every other reading.
+      // Both channels of a pair are on the same ADC, so they take turns.
+      const relay_pair &path = relay_pairs[st_relay];
+      uint8_t channel = path.channels[st_burst_channel];
+      uint16_t mux;
+      const adc_lane &lane = find_channel(channel, mux);
+      if (!service_burst(lane.address, mux, st_burst, st_burst_start_us)) {
+        return;
+      }
+      st_zero_counts[channel] = (int16_t)lroundf((float)st_burst.sum / BURST_SAMPLES);
+      if (st_zero_counts[channel] >= ADC_SHORT_COUNTS) {
+        st_relay_faults |= path.fault; // Stuck closed
+      }
+      if (st_burst_channel == 0) {
+        start_zero_burst(1);
+        return;
+      }
+      digitalWrite (relay_pins[st_relay], HIGH);
+      st_wait_start = millis();
+      st_state = ST_RELAY_ON;
+      return;
+    }
+
+    case ST_RELAY_ON: {
+      // Relay closed again - with the socket empty both channels go back up to open
+      if (now - st_wait_start < RELAY_SETTLE_MS) {
+        return;
+      }
+      const relay_pair &path = relay_pairs[st_relay];
+      for (int c = 0; c < 2; c++)
+      {
+        if (read_channel_now(path.channels[c]) <= ADC_OPEN_COUNTS) {
+          st_dead_paths |= path.fault; // Stuck open, or a broken trace / socket pin.  Cleared once it reads open.
+        }
+      }
+      if (++st_relay < NUM_RELAYS) {
+        digitalWrite (relay_pins[st_relay], LOW);
+        st_wait_start = millis();
+        st_state = ST_RELAY_OFF;
+        return;
+      }
+      finish_self_test(true);
+      return;
+    }
+  }
+}
+
+
+// Act on whatever the touch handlers asked for
+void service_input()
+{
+  if (page_requested) {
+    page_requested = false;
+    current_page = (display_page)((current_page + 1) % PAGE_COUNT);
+    render_row = 0;
+  }
+
+  if (retest_requested && current_page == PAGE_DIAGNOSTICS) {
+    // On the Diagnostics page Re-test checks the fixture.  It leaves the baseline alone.
+    retest_requested = false;
+    selftest_requested = true;
+  }
+
+  if (baseline_requested) {
+    // Re-test held down on the Diagnostics page: check the fixture and, if it passes, save it as
+    // the new baseline.  A deliberate action, it throws away the old reference and any DRIFT.
+    baseline_requested = false;
+    if (current_page == PAGE_DIAGNOSTICS) {
+      selftest_requested = true;
+      selftest_save_baseline = true;
+    }
+  }
+
+  if (retest_requested && dut_recorded && !dut_from_old_lot) {
+    // Take the last verdict for this DUT back out of the lot, the fresh one replaces it
+    count_in_lot(recorded_measurement, -1);
+    dut_recorded = false;
+    dut_settle = DUT_SETTLE_CYCLES - 1;
+    render_row = 0;
+  }
+
+  if (lot_reset_requested) {
+    lot_reset_requested = false;
+    memset(&lot, 0, sizeof(lot));
+    // A DUT still in the socket belongs to the old lot.  Leave it marked as counted so it isn't
+    // counted again, and keep a re-test from taking it out of the new lot's numbers.
+    dut_from_old_lot = dut_recorded;
+    loop_max_ms = 0;
+    sample_late_max_us = 0;
+    i2c_errors = 0;
+    render_row = 0;
+  }
+}
+
+
+// Text and color of one row of the results page
+void format_results_row(uint8_t row, char *text, uint16_t &color)
+{
+  const measurement &m = last_measurement;
+
+  if (row == 0) {
+    uint8_t faults = fixture_faults();
+    if (faults & FIXTURE_BLOCKING_FAULTS) {
+      // Don't let a fixture problem look like a bad part
+      char fault_text[48];
+      describe_fixture_faults(faults, fault_text, sizeof(fault_text));
+      color = TFT_RED;
+      sprintf(text, " FIXTURE: %s", fault_text);
+      return;
+    }
+    // format environment output
+    color = faults ? TFT_YELLOW : TFT_WHITE;
+    sprintf(text, " Vtest = %1.3fV   Temp = %2.1fF", m.VTEST, m.TEMP);
+    return;
+  }
+
+  int i = row - 1;
+  if (i >= NUM_DUT_RESISTORS) {
+    return;
+  }
+  const dut_resistor &r = dut_resistors[i];
+  color = m.in_tolerance[i] ? TFT_GREEN : TFT_RED;
+  if (m.state[i] == RES_OPEN) {
+    sprintf(text, "%s = Open", r.name);
+  } else if (m.state[i] == RES_SHORT) {
+    sprintf(text, "%s = Short", r.name);
+  } else {
+    // Somewhere between 0 and inf
+    sprintf(text, r.format, m.resistance[i], i == R4_INDEX ? m.model_value : r.desired);
+  }
+}
+
+
+// Text and color of one row of the lot statistics page
+void format_stats_row(uint8_t row, char *text, uint16_t &color)
+{
+  switch (row) {
+    case 0:
+      strcpy(text, " Lot Statistics");
+      break;
+    case 1:
+      sprintf(text, " Tested = %lu", (unsigned long)lot.tested);
+      break;
+    case 2:
+      color = TFT_GREEN;
+      sprintf(text, " Pass = %lu   Yield = %3.1f%%", (unsigned long)lot.passed, lot.tested ? 100.0 * lot.passed / lot.tested : 0.0);
+      break;
+    case 3:
+      color = lot.failed ? TFT_RED : TFT_WHITE;
+      sprintf(text, " Fail = %lu", (unsigned long)lot.failed);
+      break;
+    case 4:
+      sprintf(text, " 6K = %lu   8K = %lu", (unsigned long)lot.model_6k, (unsigned long)lot.model_8k);
+      break;
+    case 5:
+      sprintf(text, " R1 %lu   R2 %lu   R3 %lu", (unsigned long)lot.resistor_fails[0], (unsigned long)lot.resistor_fails[1], (unsigned long)lot.resistor_fails[2]);
+      break;
+    case 6:
+      sprintf(text, " R4 %lu   R5 %lu   R6 %lu", (unsigned long)lot.resistor_fails[3], (unsigned long)lot.resistor_fails[4], (unsigned long)lot.resistor_fails[5]);
+      break;
+  }
+}
+
+
+// Text and color of one row of the diagnostics page
+void format_diagnostics_row(uint8_t row, char *text, uint16_t &color)
+{
+  const measurement &m = last_measurement;
+
+  switch (row) {
+    case 0:
+      sprintf(text, " Vin = %2.2fV   Vtest = %1.3fV", m.VIN, m.VTEST);
+      break;
+    case 1: {
+      uint8_t faults = fixture_faults();
+      if (faults) {
+        char fault_text[48];
+        describe_fixture_faults(faults, fault_text, sizeof(fault_text));
+        color = faults & FIXTURE_BLOCKING_FAULTS ? TFT_RED : TFT_YELLOW;
+        sprintf(text, " Fixture: %s", fault_text);
+      } else {
+        color = TFT_GREEN;
+        sprintf(text, " Fixture OK   %s", have_baseline ? "baseline saved" : "no baseline");
+      }
+      break;
+    }
+    case 2:
+      // U5 raw counts in AIN0..AIN3 order
+      sprintf(text, " U5 %d %d %d %d", m.counts[CH_VTEST], m.counts[CH_R6], m.counts[CH_VIN], m.counts[CH_R4]);
+      break;
+    case 3:
+      // U6 raw counts in AIN0..AIN3 order
+      sprintf(text, " U6 %d %d %d %d", m.counts[CH_R2], m.counts[CH_R3], m.counts[CH_R1], m.counts[CH_R5]);
+      break;
+    case 4:
+      sprintf(text, " Cycle = %lums   #%lu   %2.1fF", (unsigned long)m.duration_ms, (unsigned long)cycle_count, m.TEMP);
+      break;
+    case 5:
+      // Worst time between two touch panel reads since boot or the last lot reset
+      color = loop_max_ms < 50 ? TFT_GREEN : TFT_RED;
+      sprintf(text, " Input latency max = %lums", (unsigned long)loop_max_ms);
+      break;
+    case 6:
+      // How far behind schedule a burst sample started, worst case.  Small next to SAMPLE_SPACING_US is good.
+      color = sample_late_max_us < SAMPLE_SPACING_US / 2 && !i2c_errors ? TFT_GREEN : TFT_RED;
+      if (i2c_errors) {
+        sprintf(text, " I2C errors = %lu  late = %luus", (unsigned long)i2c_errors, (unsigned long)sample_late_max_us);
+      } else {
+        sprintf(text, " %dHz  %d x %d  late = %luus", MAINS_HZ, ACQ_SLOTS, BURST_SAMPLES, (unsigned long)sample_late_max_us);
+      }
+      break;
+  }
+}
+
+
+// Draw one row of the current page.  Called once per pass of loop() so a full
+// screen update never holds up the touch panel or the ADCs for long.
+void render_next_row()
+{
+  char text[64] = "";
+  uint16_t color = TFT_WHITE;
+
+  if (render_row >= DISPLAY_ROWS) {
+    return;
+  }
+  if (acq_state != ACQ_IDLE || st_state == ST_ZERO_BURST) {
+    return; // Drawing a row takes longer than SAMPLE_SPACING_US, wait until the bursts are done
+  }
+  if (have_measurement || current_page == PAGE_STATS) {
+    switch (current_page) {
+      case PAGE_RESULTS:
+        format_results_row(render_row, text, color);
+        break;
+      case PAGE_STATS:
+        format_stats_row(render_row, text, color);
+        break;
+      default:
+        format_diagnostics_row(render_row, text, color);
+        break;
+    }
+  }
+
+  int16_t y = render_row * ROW_HEIGHT;
+  M5.Lcd.fillRect(0, y, 320, ROW_HEIGHT, TFT_BLACK);
+  M5.Lcd.setFreeFont(FS12);      // Select Free Serif 12 point font
+  M5.Lcd.setTextDatum(TL_DATUM);
+  M5.Lcd.setTextColor(color, TFT_BLACK);
+  M5.Lcd.drawString(text, 0, y + 4);
+
+  render_row++;
+}
+
+
+
+// Turn on / off all relays
+void set_relays(uint8_t level)
+{
+  digitalWrite (RELAY1_CONTROL, level); // Relay1 / Resistors R2 and R3
+  digitalWrite (RELAY2_CONTROL, level); // Relay2 / Resistors R1 and R5
+  digitalWrite (RELAY3_CONTROL, level); // Relay3 / Resistors R4 and R6
+}
+
+
+// Nobody is testing - dim the screen and stop heating the test resistors
+void enter_idle()
+{
+  // Both ADS1115s run in single-shot mode and power themselves down after every conversion.
+  // We only go idle between cycles, so nothing is converting and no new conversion gets started.
+  // Relay3 stays closed so the DUT probe can see R4 without switching a relay twice a second -
+  // that would put ~170k operations a day on it.  Only R4 / R6 stay powered.
+  digitalWrite (RELAY1_CONTROL, LOW); // Relay1 / Resistors R2 and R3
+  digitalWrite (RELAY2_CONTROL, LOW); // Relay2 / Resistors R1 and R5
+  M5.Axp.SetLcdVoltage(LCD_IDLE_VOLTAGE);
+
+  M5.Lcd.fillRect(0, 0, 320, DISPLAY_ROWS * ROW_HEIGHT, TFT_BLACK);
+  M5.Lcd.setFreeFont(FS12);
+  M5.Lcd.setTextDatum(MC_DATUM);
+  M5.Lcd.setTextColor(TFT_DARKGREY, TFT_BLACK);
+  M5.Lcd.drawString("Idle - touch or insert a DUT", 160, DISPLAY_ROWS * ROW_HEIGHT / 2);
+  render_row = DISPLAY_ROWS;
+
+  idle = true;
+}
+
+
+void exit_idle()
+{
+  idle = false;
+  M5.Axp.SetLcdVoltage(LCD_ACTIVE_VOLTAGE);
+  set_relays(HIGH);
+
+  // Give the test resistors time to settle, then measure right away
+  acq_cycle_start = millis() + WAKE_SETTLE_MS - MEASURE_INTERVAL_MS;
+  last_activity_ms = millis();
+  last_loop_pass = millis();
+  render_row = 0;
+}
+
+
+// Read R4 through Relay3, which stays closed while idle, to see if there is a DUT in the socket.
+// Every DUT has R4, so this is enough to detect an insertion.
+bool probe_for_dut()
+{
+  int16_t adc3 = ads.readADC_SingleEnded(3); // U5_AIN3 - DUT_R4
+  return adc3 <= ADC_OPEN_COUNTS;
+}
+
+
+// Light sleep until the panel is touched or it is time to probe for a DUT
+void service_idle()
+{
+  esp_sleep_enable_timer_wakeup(IDLE_DUT_POLL_MS * 1000ULL);
+  gpio_wakeup_enable(TOUCH_INT, GPIO_INTR_LOW_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+  esp_light_sleep_start();
+
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO || probe_for_dut()) {
+    exit_idle();
+    // The touch that woke us up shouldn't also press a button.  Let the touch library
+    // see it now so it isn't reported as a new touch later, then drop what it asked for.
+    M5.update();
+    page_requested = false;
+    retest_requested = false;
+    lot_reset_requested = false;
+    baseline_requested = false;
+  }
+}
+
+
+// Decide if it is time to go idle
+void service_power()
+{
+  uint32_t now = millis();
+
+  if (M5.Touch.ispressed()) {
+    last_activity_ms = now;
+  }
+  if (acq_state != ACQ_IDLE || st_state != ST_IDLE || dut_settle > 0 || dut_recorded) {
+    return; // Mid-cycle or a DUT is in the socket
+  }
+  if (dead_paths & FIXTURE_RELAY3) {
+    return; // The idle probe reads R4 through Relay3 - it would see a DUT and wake us right back up
+  }
+  if (now - last_activity_ms >= IDLE_TIMEOUT_MS) {
+    enter_idle();
+  }
+}
+
 
 // Setup Runs Once
 void setup() {
-  
+
   // M5.begin Line from SodaSaver:  M5.begin(true,true,false,false,kMBusModeInput); //Init M5Core2- bool LCDEnable = true, bool SDEnable = true, bool SerialEnable = false, bool I2CEnable = false, AXP192 power mode OUTPUT to power ext hardwre
   M5.begin(true, true, true, false, kMBusModeInput); //Init M5Core2(Initialization of external I2C is also included).   LCD Enable, SDEnable, Serial Enable, I2C Enable, kMBusModeInput (kMBusModeInput tells Stack it is powered by external MBus 5V, kMBusModeOutput tells stack it is powered internally by USB or internal battery)
   delay(100);
@@ -82,10 +990,13 @@ void setup() {
   pinMode(RELAY2_CONTROL, OUTPUT); // Power to Test Resistors R1 and R5
   pinMode(RELAY3_CONTROL, OUTPUT); // Power to Test Resistors R4 and R6
 
-  // Enable Internal I2C
-  Wire.begin(21, 22); //Everything is on the M5Stack Internal I2C Bus
+  // Internal I2C
+  // Everything is on the M5Stack Internal I2C Bus (G21 / G22).  M5.begin() has already started it as
+  // Wire1 for the FT6336U touch panel and the AXP192, so the ADCs and the MCP9802 use Wire1 too.
+  // Calling Wire.begin(21, 22) here would hand the same pins to the other I2C controller and cut
+  // the touch panel and backlight off.
   delay(1000);
-  Wire.setClock(100000UL); // 400kHz Internal Bus Speed
+  Wire1.setClock(400000UL); // 400kHz Internal Bus Speed - the mains-synchronous bursts need it
 
   // Begin U5 ADC
   // ads.setGain(GAIN_TWOTHIRDS);  // 2/3x gain +/- 6.144V  1 bit = 3mV      0.1875mV (default)
@@ -94,7 +1005,8 @@ void setup() {
   // ads.setGain(GAIN_FOUR);       // 4x gain   +/- 1.024V  1 bit = 0.5mV    0.03125mV
   // ads.setGain(GAIN_EIGHT);      // 8x gain   +/- 0.512V  1 bit = 0.25mV   0.015625mV
   // ads.setGain(GAIN_SIXTEEN);    // 16x gain  +/- 0.256V  1 bit = 0.125mV  0.0078125mV
-  if (!ads.begin(ADS1115_U5)) {
+  ads.setDataRate(RATE_ADS1115_860SPS); // Fast conversions for the mains-synchronous bursts
+  if (!ads.begin(ADS1115_U5, &Wire1)) {
     Serial.println("Failed to initialize U5 ADC.");
     while (1); // Halt and Catch Fire
   }
@@ -106,7 +1018,8 @@ void setup() {
   // ads2.setGain(GAIN_FOUR);       // 4x gain   +/- 1.024V  1 bit = 0.5mV    0.03125mV
   // ads2.setGain(GAIN_EIGHT);      // 8x gain   +/- 0.512V  1 bit = 0.25mV   0.015625mV
   // ads2.setGain(GAIN_SIXTEEN);  // 16x gain  +/- 0.256V  1 bit = 0.125mV  0.0078125mV
-  if (!ads2.begin(ADS1115_U6)) {
+  ads2.setDataRate(RATE_ADS1115_860SPS); // Fast conversions for the mains-synchronous bursts
+  if (!ads2.begin(ADS1115_U6, &Wire1)) {
     Serial.println("Failed to initialize U6 ADC.");
     while (1); // Halt and Catch Fire
   }
@@ -116,275 +1029,66 @@ void setup() {
   M5.Lcd.setTextColor(TFT_WHITE, TFT_BLACK);
   M5.Lcd.setFreeFont(FSB12);      // Select Free Serif 9 point font
   M5.Lcd.setTextDatum(MC_DATUM); // cursor is top left of text - not sure if this works with print
-  M5.Lcd.setCursor(0, 30);       // Set initial position - might not be needed withdrawString? 
+  M5.Lcd.setCursor(0, 30);       // Set initial position - might not be needed withdrawString?
   M5.Lcd.println("                  batee.com");
   M5.Lcd.println("         Analog Cal IC Tester");
   M5.Lcd.println("            Hardware: v2.2.1");
-  M5.Lcd.println("            Firmware v1.0.0");
+  M5.Lcd.println("            Firmware v1.1.0");
   M5.Lcd.println("         by CrazyUncleBurton");
   M5.Lcd.println(" ");
   M5.Lcd.println("        Waiting for Warmup...");
 
   // Enable All Relays
-  digitalWrite (RELAY1_CONTROL, HIGH); // Turn On Relay1 / Resistors R2 and R3
-  digitalWrite (RELAY2_CONTROL, HIGH); // Turn On Relay2 / Resistors R1 and R5
-  digitalWrite (RELAY3_CONTROL, HIGH); // Turn On Relay3 / Resistors R4 and R6
+  set_relays(HIGH);
 
   // Delay for Warm-up
   delay(1000);
 
-}
-
-
-void loop() {
-  while (1)
-  {
-
-    int16_t adc0, adc1, adc2, adc3, adc4, adc5, adc6, adc7, adc8; // Actual count measured by the ADC
-    float U5_AIN0, U5_AIN1, U5_AIN2, U5_AIN3, U6_AIN0, U6_AIN1, U6_AIN2, U6_AIN3; // Actual voltage measured by the ADC
-    float VIN, VTEST; // Calculated values of measured voltages with voltage dividers factored in
-    float R1_calculated, R2_calculated, R3_calculated, R4_calculated, R5_calculated, R6_calculated;  // Calculated value of the resistors under test
-    char environment_string[128];
-    float TEMP = 74;
-    char TEMP_string[16];
-    char R1_resistance_string[16];
-    char R2_resistance_string[16];
-    char R3_resistance_string[16];
-    char R4_resistance_string[16];
-    char R5_resistance_string[16];
-    char R6_resistance_string[16];
-    float R1_test_resistor = 97.050; // in kOhms as measured from ground to the DUT Socket pin 10
-    // for some reason, R1 was measuring high by about 1K.  So I changed the test resistor from 
-    // its measured value of 96.3k to 97.050k to correct the output test result..  
-    float R2_test_resistor = 4.017; // in kOhms as measured from ground to the DUT Socket pin 13
-    float R3_test_resistor = 2.001; // in kOhms as measured from ground to the DUT Socket pin 11
-    float R4_test_resistor = 175.500; // in kOhms as measured from ground to the DUT Socket pin 4
-    // This measures about 1.5K low with correct value of test resistor.  I changed this value to 
-    // 175.5k to correct the output test result.
-    float R5_test_resistor = 4.518; // in kOhms as measured from ground to the DUT Socket pin 9
-    float R6_test_resistor = 3.001; // in kOhms as measured from ground to the DUT Socket pin 7
-    float R1_desired = 96.00; // in kOhms, this is the value we install on the ICs
-    float R2_desired = 4.02; // in kOhms, this is the value we install on the ICs
-    float R3_desired = 2.00; // in kOhms, this is the value we install on the ICs
-    float R4_desired_1 = 174.00; // in kOhms, this is the value we install on the ICs
-    float R4_desired_2 = 124.00; // in kOhms, this is the value we install on the ICs
-    float R5_desired = 4.53; // in kOhms, this is the value we install on the ICs
-    float R6_desired = 3.00; // in kOhms, this is the value we install on the ICs
-    
-    float VIN_divider = 6.00235386; // VIN = VIN_divider * U5_AIN2 - actual measured value
-    float VTEST_divider = 2.0011928; // VTEST = VTEST_divider * U5_AIN0 - actual measured value
-    int model = 0; // Which model did we detect?  6=6k, 8=8k, 0 = not close to either
-    float model_value;
-
-    // Measure 15V0 Input Voltage
-    adc2 = ads.readADC_SingleEnded(2); // U5_AIN2 - 15V0 Power In Voltage
-    U5_AIN2 = ads.computeVolts(adc2); // U5_AIN2 - 15V0 Power In Voltage
-    // U5_AIN2 is the measured voltage.  We need to multiply by the voltage divider to recover the actual voltage
-    VIN = U5_AIN2 * VIN_divider;
-
-    // Measure 5V0 Test Voltage
-    adc0 = ads.readADC_SingleEnded(0); // U5_AIN0 - 5V0 Test Voltage
-    U5_AIN0 = ads.computeVolts(adc0); // U5_AIN0 - 5V0 Test Voltage
-    VTEST = U5_AIN0 * VTEST_divider;
-
-    // Measure TEMP
-    // For some reason, the first reading is always excessively high.
-    // Read the TEMP twice to work around this problem.
-    TEMP = get_temperature();
-    if (TEMP > 100) 
-    {
-      TEMP = get_temperature();
-    }
-
-    // Measure R1
-    adc6 = ads2.readADC_SingleEnded(2); // U6_AIN2 - DUT_R1
-    U6_AIN2 = ads2.computeVolts(adc6); // U6_AIN2 - DUT_R1
-    R1_calculated = ((U6_AIN2 * R1_test_resistor ) / (VTEST - U6_AIN2)); // in kOhms
-
-    // Measure R2
-    adc4 = ads2.readADC_SingleEnded(0); // U6_AIN0 - DUT_R2
-    U6_AIN0 = ads2.computeVolts(adc4); // U6_AIN0 - DUT_R2
-    R2_calculated = ((U6_AIN0 * R2_test_resistor ) / (VTEST - U6_AIN0)); // in kOhms
-
-    // Measure R3
-    adc5 = ads2.readADC_SingleEnded(1); // U6_AIN1 - DUT_R3
-    U6_AIN1 = ads2.computeVolts(adc5); // U6_AIN1 - DUT_R3
-    R3_calculated = ((U6_AIN1 * R3_test_resistor ) / (VTEST - U6_AIN1)); // in kOhms
-
-    // Measure R4
-    adc3 = ads.readADC_SingleEnded(3); // U5_AIN3 - DUT_R4
-    U5_AIN3 = ads.computeVolts(adc3); // U5_AIN3 - DUT_R4
-    R4_calculated = ((U5_AIN3 * R4_test_resistor ) / (VTEST - U5_AIN3)); // in kOhms
-
-    // Measure R5
-    adc7 = ads2.readADC_SingleEnded(3); // U6_AIN3 - DUT_R5
-    U6_AIN3 = ads2.computeVolts(adc7); // U6_AIN3 - DUT_R5
-    R5_calculated = ((U6_AIN3 * R5_test_resistor ) / (VTEST - U6_AIN3)); // in kOhms
-
-    // Measure R6
-    adc1 = ads.readADC_SingleEnded(1); // U5_AIN1 - DUT_R6
-    U5_AIN1 = ads.computeVolts(adc3); // U5_AIN1 - DUT_R6
-    R6_calculated = ((U5_AIN1 * R6_test_resistor ) / (VTEST - U5_AIN1)); // in kOhms.  
-    
-
-    // Report Results
-    M5.Lcd.clear();   // Clear the contents displayed on the screen
-    M5.Lcd.setTextColor(TFT_WHITE, TFT_BLACK);
-    M5.Lcd.setFreeFont(FS12);      // Select Free Serif 9 point font
-    M5.Lcd.setTextDatum(MC_DATUM); // cursor is top left of text - not sure if this works with print
-    M5.Lcd.setCursor(0,30);
-
-    // format environment output and print
-    sprintf(environment_string," Vtest = %1.3fV   Temp = %2.1fF", VTEST, TEMP);
-    M5.Lcd.println(environment_string);
-
-    // R1
-    // It doesn't matter which model this is.  R1 needs to be set to 96k.  
-    // Change the 100k resistor R1 to 96k on the board
-    if (abs((R1_calculated - R1_desired)/R1_desired) < 0.01 ) 
-    {
-      M5.Lcd.setTextColor(TFT_GREEN, TFT_BLACK);
-    } else {
-      M5.Lcd.setTextColor(TFT_RED, TFT_BLACK);
-    } 
-    if (adc6 > 29500) {
-      // Open
-      strcpy(R1_resistance_string, " R1 = Open");
-    } 
-    if (adc6 < 3277) 
-    {
-      // Shorted
-      strcpy(R1_resistance_string, " R1 = Short");
-    }
-    if ((3278 < adc6) and (adc6 < 29500)) {
-      // Somewhere between 0 and inf
-      sprintf(R1_resistance_string," R1 =   %3.2fk  Target =  %3.2fk",R1_calculated, R1_desired);
-    }
-    M5.Lcd.println(R1_resistance_string);
-
-    // R2
-    if (abs((R2_calculated - R2_desired)/R2_desired) < 0.01 ) 
-    {
-      M5.Lcd.setTextColor(TFT_GREEN, TFT_BLACK);
-    } else {
-      M5.Lcd.setTextColor(TFT_RED, TFT_BLACK);
-    }
-    if (adc4 > 29500) {
-      // Open
-      strcpy(R2_resistance_string, " R2 = Open");
-    } 
-    if (adc4 < 3277) 
-    {
-      // Shorted
-      strcpy(R2_resistance_string, " R2 = Short");
-    }
-    if ((3278 < adc4) and (adc4 < 29500)) {
-      // Somewhere between 0 and inf
-      sprintf(R2_resistance_string," R2 =     %1.2fk  Target =    %1.2fk",R2_calculated, R2_desired);
-    }
-    M5.Lcd.println(R2_resistance_string);
-
-
-    // R3
-    if (abs((R3_calculated - R3_desired)/R3_desired) < 0.01 ) 
-    {
-      M5.Lcd.setTextColor(TFT_GREEN, TFT_BLACK);
-    } else {
-      M5.Lcd.setTextColor(TFT_RED, TFT_BLACK);
-    }
-    if (adc5 > 29500) {
-      // Open
-      strcpy(R3_resistance_string, " R3 = Open");
-    } 
-    if (adc5 < 3277) 
-    {
-      // Shorted
-      strcpy(R3_resistance_string, " R3 = Short");
-    }
-    if ((3278 < adc5) and (adc5 < 29500)) {
-      // Somewhere between 0 and inf
-      sprintf(R3_resistance_string," R3 =     %1.2fk  Target =    %1.2fk",R3_calculated, R3_desired);
-    } 
-    M5.Lcd.println(R3_resistance_string);
+  // Fixture self-test against the baseline cached in NVS.  The first healthy self-test saves one.
+  prefs.begin("fixture", false);
+  have_baseline = prefs.getBytes("baseline", &baseline, sizeof(baseline)) == sizeof(baseline)
+    && baseline.version == FIXTURE_BASELINE_VERSION;
+  // The boot self-test runs right after the first measurement cycle
+  selftest_requested = true;
 
+  // Touch buttons.  Handlers fire on E_TOUCH so the button lights up the moment it is touched.
+  M5.Lcd.clear();
+  page_button.addHandler(on_page_touch, E_TOUCH);
+  retest_button.addHandler(on_retest_touch, E_TOUCH);
+  lot_button.addHandler(on_lot_touch, E_TOUCH);
+  M5.BtnA.addHandler(on_page_touch, E_TOUCH);
+  M5.BtnB.addHandler(on_retest_touch, E_TOUCH);
+  retest_button.longPressTime = BASELINE_HOLD_MS;
+  M5.BtnB.longPressTime = BASELINE_HOLD_MS;
+  retest_button.addHandler(on_retest_hold, E_LONGPRESSING);
+  M5.BtnB.addHandler(on_retest_hold, E_LONGPRESSING);
+  M5.BtnC.addHandler(on_lot_touch, E_TOUCH);
+  M5.Buttons.draw();
 
-    // R4
-    M5.Lcd.setTextColor(TFT_RED, TFT_BLACK);
-    if (abs((R4_calculated - R4_desired_1)/R4_desired_1) < 0.01 ) 
-    {
-      // 6K
-      model=6;
-      model_value = R4_desired_1;
-      M5.Lcd.setTextColor(TFT_GREEN, TFT_BLACK);
-    }
+  acq_cycle_start = millis() - MEASURE_INTERVAL_MS; // Start measuring right away
+  last_activity_ms = millis();
+  last_loop_pass = millis();
+}
 
-    if (abs((R4_calculated - R4_desired_2)/R4_desired_2) < 0.01 ) 
-    {
-      // 8K
-      model=8;
-      model_value = R4_desired_2;
-      M5.Lcd.setTextColor(TFT_GREEN, TFT_BLACK);
-    } 
-    if (adc3 > 29500) {
-      // Open
-      strcpy(R4_resistance_string, " R4 = Open");
-    } 
-    if (adc3 < 3277) 
-    {
-      // Shorted
-      strcpy(R4_resistance_string, " R4 = Short");
-    }
-    if ((3278 < adc3) and (adc3 < 29500)) {
-      // Somewhere between 0 and inf
-      sprintf(R4_resistance_string," R4 = %3.2fk  Target =%3.2fk",R4_calculated, model_value);
-    } 
-    M5.Lcd.println(R4_resistance_string);
-
-    // R5
-    if (abs((R5_calculated - R5_test_resistor)/R5_test_resistor) < 0.01 ) 
-    {
-      M5.Lcd.setTextColor(TFT_GREEN, TFT_BLACK);
-    } else {
-      M5.Lcd.setTextColor(TFT_RED, TFT_BLACK);
-    }if (adc7 > 29500) {
-      // Open
-      strcpy(R5_resistance_string, " R5 = Open");
-    } 
-    if (adc7 < 3277) 
-    {
-      // Shorted
-      strcpy(R5_resistance_string, " R5 = Short");
-    }
-    if ((3278 < adc7) and (adc7 < 29500)) {
-      // Somewhere between 0 and inf
-          sprintf(R5_resistance_string," R5 =     %1.2fk  Target =    %1.2fk",R5_calculated, R5_desired);
-    } 
-    M5.Lcd.println(R5_resistance_string);
-
-    // R6
-    if (abs((R6_calculated - R6_test_resistor)/R6_test_resistor) < 0.01 ) 
-    {
-      M5.Lcd.setTextColor(TFT_GREEN, TFT_BLACK);
-    } else {
-      M5.Lcd.setTextColor(TFT_RED, TFT_BLACK);
-    }
-    if (adc1 > 29500) {
-      // Open
-      strcpy(R6_resistance_string, " R6 = Open");
-    } 
-    if (adc1 < 3277) 
-    {
-      // Shorted
-      strcpy(R6_resistance_string, " R6 = Short");
-    }
-    if ((3278 < adc1) and (adc1 < 29500)) {
-      // Somewhere between 0 and inf
-          sprintf(R6_resistance_string," R6 =     %1.2fk  Target =    %1.2fk",R6_calculated, R6_desired);
-    } 
-    M5.Lcd.println(R6_resistance_string);
 
-    // Wait for screen to clear, then Clear Screen and loop
-    delay(500); // We can't loop more than 128 samples per second (maybe 32 x 4 channels per ADC = 31.25mS)
+// Each pass of loop() does a small, bounded amount of work: read the touch panel,
+// poll the ADCs, draw at most one row.  That keeps touch-to-feedback well under 50ms.
+void loop() {
+  if (idle) {
+    service_idle();
+    return;
+  }
 
+  uint32_t now = millis();
+  if (now - last_loop_pass > loop_max_ms) {
+    loop_max_ms = now - last_loop_pass;
   }
+  last_loop_pass = now;
+
+  M5.update(); // Reads the FT6336U and runs the touch handlers
+  service_input();
+  service_acquisition();
+  service_self_test();
+  render_next_row();
+  service_power();
 }
@@ -0,0 +1,224 @@
+/*
+
+  batee.com 90-96 Analog Cal IC Tester - Fixture Health Tests
+
+  Checks the self-test limits and baseline comparisons in lib/AnalogCal.
+
+  Run with:  pio test -e native -f test_fixture_health
+
+*/
+
+#include <unity.h>
+#include <fixture_health.h>
+
+#include <string.h>
+
+static fixture_baseline baseline;
+
+
+void setUp()
+{
+  memset(&baseline, 0, sizeof(baseline));
+  baseline.version = FIXTURE_BASELINE_VERSION;
+  baseline.VIN = 14.5f;
+  baseline.VTEST = 5.0f;
+  for (int i = 0; i < CH_COUNT; i++)
+  {
+    baseline.zero_counts[i] = 10;
+  }
+}
+
+void tearDown()
+{
+}
+
+
+void test_supplies_inside_limits()
+{
+  TEST_ASSERT_EQUAL_UINT8(0, check_supplies(14.5f, 5.0f));
+  // The limits themselves are still good
+  TEST_ASSERT_EQUAL_UINT8(0, check_supplies(VIN_MIN, VTEST_MIN));
+  TEST_ASSERT_EQUAL_UINT8(0, check_supplies(VIN_MAX, VTEST_MAX));
+}
+
+void test_supplies_outside_limits()
+{
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_VIN_LOW, check_supplies(VIN_MIN - 0.01f, 5.0f));
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_VIN_HIGH, check_supplies(VIN_MAX + 0.01f, 5.0f));
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_VTEST_LOW, check_supplies(14.5f, VTEST_MIN - 0.001f));
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_VTEST_HIGH, check_supplies(14.5f, VTEST_MAX + 0.001f));
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_VIN_LOW | FIXTURE_VTEST_LOW, check_supplies(0, 0));
+}
+
+void test_drift_supplies_only_when_zero_counts_null()
+{
+  TEST_ASSERT_EQUAL_UINT8(0, check_baseline_drift(14.5f, 5.0f, NULL, baseline));
+  TEST_ASSERT_EQUAL_UINT8(0, check_baseline_drift(14.5f * 1.02f, 5.0f * 1.004f, NULL, baseline));
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_DRIFT, check_baseline_drift(14.5f * 1.04f, 5.0f, NULL, baseline));
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_DRIFT, check_baseline_drift(14.5f * 0.96f, 5.0f, NULL, baseline));
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_DRIFT, check_baseline_drift(14.5f, 5.0f * 1.006f, NULL, baseline));
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_DRIFT, check_baseline_drift(14.5f, 5.0f * 0.994f, NULL, baseline));
+}
+
+void test_zero_count_drift_is_one_sided()
+{
+  int16_t zero_counts[CH_COUNT];
+  memcpy(zero_counts, baseline.zero_counts, sizeof(zero_counts));
+  TEST_ASSERT_EQUAL_UINT8(0, check_baseline_drift(14.5f, 5.0f, zero_counts, baseline));
+
+  // Reading lower than the baseline with the relay off isn't leakage
+  zero_counts[CH_R3] = baseline.zero_counts[CH_R3] - 500;
+  TEST_ASSERT_EQUAL_UINT8(0, check_baseline_drift(14.5f, 5.0f, zero_counts, baseline));
+
+  // Exactly the limit is allowed, one count more is drift
+  zero_counts[CH_R3] = baseline.zero_counts[CH_R3] + ZERO_DRIFT_COUNTS;
+  TEST_ASSERT_EQUAL_UINT8(0, check_baseline_drift(14.5f, 5.0f, zero_counts, baseline));
+  zero_counts[CH_R3] = baseline.zero_counts[CH_R3] + ZERO_DRIFT_COUNTS + 1;
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_DRIFT, check_baseline_drift(14.5f, 5.0f, zero_counts, baseline));
+}
+
+void test_zero_count_drift_ignores_supply_channels()
+{
+  int16_t zero_counts[CH_COUNT];
+  memcpy(zero_counts, baseline.zero_counts, sizeof(zero_counts));
+  zero_counts[CH_VIN] = 20000;
+  zero_counts[CH_VTEST] = 20000;
+  TEST_ASSERT_EQUAL_UINT8(0, check_baseline_drift(14.5f, 5.0f, zero_counts, baseline));
+}
+
+void test_describe_faults()
+{
+  char text[64];
+  describe_fixture_faults(0, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("", text);
+  describe_fixture_faults(FIXTURE_VTEST_LOW, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("VTEST LOW", text);
+  describe_fixture_faults(FIXTURE_VIN_LOW | FIXTURE_RELAY2 | FIXTURE_DRIFT, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("VIN LOW RELAY2 DRIFT", text);
+}
+
+void test_describe_faults_truncates()
+{
+  // Canary after the buffer must survive, and the text must stay terminated
+  char text[16];
+  memset(text, 'x', sizeof(text));
+  describe_fixture_faults(0xFF, text, 10);
+  TEST_ASSERT_EQUAL_STRING("VIN LOW V", text);
+  for (size_t i = 10; i < sizeof(text); i++)
+  {
+    TEST_ASSERT_EQUAL_CHAR('x', text[i]);
+  }
+
+  // Fills the buffer exactly
+  memset(text, 'x', sizeof(text));
+  describe_fixture_faults(FIXTURE_VIN_LOW, text, 8);
+  TEST_ASSERT_EQUAL_STRING("VIN LOW", text);
+  TEST_ASSERT_EQUAL_CHAR('x', text[8]);
+
+  // One byte short
+  describe_fixture_faults(FIXTURE_VIN_LOW, text, 7);
+  TEST_ASSERT_EQUAL_STRING("VIN LO", text);
+}
+
+
+// Every resistor channel at one count value, the supplies left alone
+static void fill_resistor_counts(int16_t *counts, int16_t adc)
+{
+  counts[CH_VIN] = 0;
+  counts[CH_VTEST] = 0;
+  for (int i = CH_R1; i <= CH_R6; i++)
+  {
+    counts[i] = adc;
+  }
+}
+
+void test_empty_socket_all_open()
+{
+  int16_t counts[CH_COUNT];
+  uint8_t dead = 0xFF;
+  fill_resistor_counts(counts, ADC_OPEN_COUNTS + 1);
+  TEST_ASSERT_TRUE(check_empty_socket(counts, dead));
+  TEST_ASSERT_EQUAL_UINT8(0, dead);
+}
+
+void test_empty_socket_low_pairs()
+{
+  int16_t counts[CH_COUNT];
+  uint8_t dead = 0;
+  fill_resistor_counts(counts, ADC_OPEN_COUNTS + 1);
+  // Relay3 stuck open - R4 and R6 read Short with nothing in the socket.  A part with R4 and R6
+  // shorted and no other pins touching reads the same.
+  counts[CH_R4] = 5;
+  counts[CH_R6] = 5;
+  TEST_ASSERT_TRUE(check_empty_socket(counts, dead));
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_RELAY3, dead);
+
+  // A single broken socket pin still marks its pair
+  fill_resistor_counts(counts, ADC_OPEN_COUNTS + 1);
+  counts[CH_R5] = 5;
+  TEST_ASSERT_TRUE(check_empty_socket(counts, dead));
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_RELAY2, dead);
+
+  // No power to any of them
+  fill_resistor_counts(counts, 0);
+  TEST_ASSERT_TRUE(check_empty_socket(counts, dead));
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_RELAY_FAULTS, dead);
+}
+
+void test_empty_socket_dut_present()
+{
+  int16_t counts[CH_COUNT];
+  uint8_t dead = 0;
+  fill_resistor_counts(counts, 15000);
+  TEST_ASSERT_FALSE(check_empty_socket(counts, dead));
+
+  // One resistance is enough, even with a shorted part next to it
+  fill_resistor_counts(counts, ADC_OPEN_COUNTS + 1);
+  counts[CH_R1] = ADC_SHORT_COUNTS;
+  counts[CH_R2] = 5;
+  TEST_ASSERT_FALSE(check_empty_socket(counts, dead));
+  counts[CH_R1] = ADC_OPEN_COUNTS;
+  TEST_ASSERT_FALSE(check_empty_socket(counts, dead));
+}
+
+void test_socket_occupied_ignores_dead_paths()
+{
+  int16_t counts[CH_COUNT];
+  fill_resistor_counts(counts, ADC_OPEN_COUNTS + 1);
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_RELAY_FAULTS, open_relay_pairs(counts));
+  TEST_ASSERT_FALSE(socket_occupied(counts, 0));
+
+  // R4 / R6 low.  Until Relay3 is known to be dead that is a part with shorted pins.
+  counts[CH_R4] = 5;
+  counts[CH_R6] = 5;
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_RELAY1 | FIXTURE_RELAY2, open_relay_pairs(counts));
+  TEST_ASSERT_TRUE(socket_occupied(counts, 0));
+  TEST_ASSERT_FALSE(socket_occupied(counts, FIXTURE_RELAY3));
+
+  // A DUT still shows up on the pairs that work
+  counts[CH_R2] = 15000;
+  TEST_ASSERT_TRUE(socket_occupied(counts, FIXTURE_RELAY3));
+
+  // Half open is not open
+  fill_resistor_counts(counts, ADC_OPEN_COUNTS + 1);
+  counts[CH_R1] = ADC_OPEN_COUNTS;
+  TEST_ASSERT_EQUAL_UINT8(FIXTURE_RELAY1 | FIXTURE_RELAY3, open_relay_pairs(counts));
+  TEST_ASSERT_TRUE(socket_occupied(counts, 0));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_supplies_inside_limits);
+  RUN_TEST(test_supplies_outside_limits);
+  RUN_TEST(test_drift_supplies_only_when_zero_counts_null);
+  RUN_TEST(test_zero_count_drift_is_one_sided);
+  RUN_TEST(test_zero_count_drift_ignores_supply_channels);
+  RUN_TEST(test_describe_faults);
+  RUN_TEST(test_describe_faults_truncates);
+  RUN_TEST(test_empty_socket_all_open);
+  RUN_TEST(test_empty_socket_low_pairs);
+  RUN_TEST(test_empty_socket_dut_present);
+  RUN_TEST(test_socket_occupied_ignores_dead_paths);
+  return UNITY_END();
+}
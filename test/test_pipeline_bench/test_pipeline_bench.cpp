@@ -0,0 +1,513 @@
+/*
+
+  batee.com 90-96 Analog Cal IC Tester - Measurement Pipeline Benchmark
+
+  Replays ADC traces through the pipeline in lib/AnalogCal and checks every
+  frame against the verdict stored in the trace header.  Reports frames/second
+  for the whole pipeline and the cost of each stage.
+
+  Run with:  pio test -e native -v
+
+  By default the traces are synthesized into a temporary directory from the
+  divider equations, with a few counts of noise.  To replay traces recorded on
+  a fixture instead, put them in a directory in the format below and point
+  ANALOG_CAL_TRACE_DIR at it.
+
+  The first run on a machine records its frames/second in a baseline file
+  (ANALOG_CAL_BENCH_BASELINE, .pio/pipeline_bench_baseline.txt by default).
+  Later runs fail if they are more than BENCH_TOLERANCE slower than that.
+  Delete the file, or set ANALOG_CAL_BENCH_RECORD=1, to record a new one after
+  a deliberate change.
+
+  Trace file format (*.trc, little endian):
+    trace_header
+    trace_frame[frame_count]
+
+*/
+
+#include <unity.h>
+#include <analog_cal.h>
+#include <fixture_health.h>
+
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Every trace is replayed until at least this many frames have gone through the pipeline
+#ifndef REPLAY_FRAMES
+#define REPLAY_FRAMES 2000000
+#endif
+
+// Frames in each synthesized trace file
+#define SYNTH_FRAMES 65536
+
+// The pipeline has to beat this on any machine, baseline or not.  A desktop PC does 25M - 40M
+// frames/s with -O2, so this only leaves room for a slower build machine.
+#ifndef MIN_FRAMES_PER_SECOND
+#define MIN_FRAMES_PER_SECOND 15000000
+#endif
+
+// How much slower than the recorded baseline a run may be before it fails.  Run to run noise
+// on an idle PC is about 15%.
+#ifndef BENCH_TOLERANCE
+#define BENCH_TOLERANCE 0.3
+#endif
+
+#define BENCH_BASELINE_FILE ".pio/pipeline_bench_baseline.txt"
+
+// Stage timings are taken over batches of this many frames
+#define BATCH_FRAMES 1024
+
+#define TRACE_MAGIC "ACTR"
+#define TRACE_VERSION 1
+
+struct trace_header {
+  char magic[4]; // "ACTR"
+  uint32_t version;
+  uint32_t frame_count;
+  // What every frame in the trace is expected to evaluate to
+  uint8_t expected_pass;
+  uint8_t expected_model; // 6, 8 or 0
+  uint8_t expected_present;
+  uint8_t expected_state[NUM_DUT_RESISTORS]; // resistor_state
+  uint8_t reserved[3];
+};
+
+struct trace_frame {
+  int16_t counts[CH_COUNT]; // Raw ADC counts in channel_index order
+  float temperature; // degrees F
+};
+
+struct mapped_trace {
+  std::string name;
+  int fd;
+  size_t size;
+  const trace_header *header;
+  const trace_frame *frames;
+};
+
+enum { STAGE_RESISTANCE, STAGE_OPEN_SHORT, STAGE_MODEL, STAGE_TOLERANCE, STAGE_COUNT };
+static const char *stage_names[STAGE_COUNT] = { "resistance", "open/short", "model", "tolerance" };
+
+static std::vector<mapped_trace> traces;
+static std::string synth_dir;
+
+
+// Trace synthesis
+
+// Nominal VTEST and VIN from the R78E5.0 and the GS90
+#define SYNTH_VTEST 5.0f
+#define SYNTH_VIN 15.0f
+#define SYNTH_NOISE_COUNTS 2
+
+enum synth_condition { SYNTH_NOMINAL, SYNTH_OPEN, SYNTH_SHORT };
+
+struct synth_spec {
+  const char *name;
+  float r4; // in kOhms
+  synth_condition condition[NUM_DUT_RESISTORS];
+  float offset[NUM_DUT_RESISTORS]; // Fraction the resistor is off from nominal
+  bool socket_empty;
+  // Ground truth
+  bool pass;
+  int model;
+};
+
+static const synth_spec synth_specs[] = {
+  { "good_6k", 174.0f, {}, {}, false, true, 6 },
+  { "good_8k", 124.0f, {}, {}, false, true, 8 },
+  { "good_6k_drift", 174.0f, {}, { 0.004f, -0.004f, 0.004f, 0.005f, -0.004f, 0.004f }, false, true, 6 },
+  { "open_r2", 174.0f, { SYNTH_NOMINAL, SYNTH_OPEN }, {}, false, false, 6 },
+  { "open_r4", 0.0f, { SYNTH_NOMINAL, SYNTH_NOMINAL, SYNTH_NOMINAL, SYNTH_OPEN }, {}, false, false, 0 },
+  { "short_r3", 124.0f, { SYNTH_NOMINAL, SYNTH_NOMINAL, SYNTH_SHORT }, {}, false, false, 8 },
+  { "short_r6", 174.0f, { SYNTH_NOMINAL, SYNTH_NOMINAL, SYNTH_NOMINAL, SYNTH_NOMINAL, SYNTH_NOMINAL, SYNTH_SHORT }, {}, false, false, 6 },
+  { "marginal_pass", 124.0f, {}, { 0.008f, 0, 0, -0.008f, -0.008f, 0 }, false, true, 8 },
+  { "marginal_fail_r2", 174.0f, {}, { 0, 0.013f }, false, false, 6 },
+  { "marginal_fail_r4", 174.0f, {}, { 0, 0, 0, 0.013f }, false, false, 0 },
+  { "between_models", 150.0f, {}, {}, false, false, 0 },
+  { "empty_socket", 0.0f, {}, {}, true, false, 0 },
+  // Only R4 and R6 touching, both shorted - the same readings as an empty socket with Relay3 dead
+  { "shorted_pins_only", 0.0f, { SYNTH_OPEN, SYNTH_OPEN, SYNTH_OPEN, SYNTH_SHORT, SYNTH_OPEN, SYNTH_SHORT }, {}, false, false, 0 },
+};
+
+static uint32_t synth_random = 2463534242u;
+
+static int16_t synth_counts(float volts)
+{
+  // xorshift32 so every run replays the same noise
+  synth_random ^= synth_random << 13;
+  synth_random ^= synth_random >> 17;
+  synth_random ^= synth_random << 5;
+  int noise = (int)(synth_random % (2 * SYNTH_NOISE_COUNTS + 1)) - SYNTH_NOISE_COUNTS;
+
+  long counts = lroundf(volts / ADC_VOLTS_PER_COUNT) + noise;
+  if (counts > 32767) {
+    counts = 32767; // ADS1115 clips at full scale
+  }
+  if (counts < 0) {
+    counts = 0;
+  }
+  return (int16_t)counts;
+}
+
+static void synthesize_trace(const synth_spec &spec, const char *path)
+{
+  trace_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, 4);
+  header.version = TRACE_VERSION;
+  header.frame_count = SYNTH_FRAMES;
+  header.expected_pass = spec.pass;
+  header.expected_model = spec.model;
+  header.expected_present = !spec.socket_empty;
+  for (int i = 0; i < NUM_DUT_RESISTORS; i++)
+  {
+    if (spec.socket_empty || spec.condition[i] == SYNTH_OPEN) {
+      header.expected_state[i] = RES_OPEN;
+    } else if (spec.condition[i] == SYNTH_SHORT) {
+      header.expected_state[i] = RES_SHORT;
+    } else {
+      header.expected_state[i] = RES_VALUE;
+    }
+  }
+
+  FILE *f = fopen(path, "wb");
+  TEST_ASSERT_NOT_NULL_MESSAGE(f, path);
+  fwrite(&header, sizeof(header), 1, f);
+
+  for (uint32_t n = 0; n < SYNTH_FRAMES; n++)
+  {
+    trace_frame frame;
+    frame.temperature = 74.0f + (n % 64) * 0.0625f;
+    frame.counts[CH_VIN] = synth_counts(SYNTH_VIN / VIN_divider);
+    frame.counts[CH_VTEST] = synth_counts(SYNTH_VTEST / VTEST_divider);
+    for (int i = 0; i < NUM_DUT_RESISTORS; i++)
+    {
+      const dut_resistor &r = dut_resistors[i];
+      float volts;
+      if (header.expected_state[i] == RES_OPEN) {
+        volts = SYNTH_VTEST; // Floating - pulled all the way to VTEST
+      } else if (header.expected_state[i] == RES_SHORT) {
+        volts = 0;
+      } else {
+        float nominal = i == R4_INDEX ? spec.r4 : r.tolerance_reference;
+        float resistance = nominal * (1 + spec.offset[i]);
+        volts = SYNTH_VTEST * resistance / (resistance + r.test_resistor);
+      }
+      frame.counts[r.channel] = synth_counts(volts);
+    }
+    fwrite(&frame, sizeof(frame), 1, f);
+  }
+  fclose(f);
+}
+
+
+// Trace files
+
+static void map_trace(const std::string &path, const std::string &name)
+{
+  mapped_trace t;
+  t.name = name;
+  t.fd = open(path.c_str(), O_RDONLY);
+  TEST_ASSERT_TRUE_MESSAGE(t.fd >= 0, path.c_str());
+
+  struct stat st;
+  TEST_ASSERT_EQUAL(0, fstat(t.fd, &st));
+  t.size = st.st_size;
+  TEST_ASSERT_TRUE_MESSAGE(t.size >= sizeof(trace_header), path.c_str());
+
+  void *p = mmap(NULL, t.size, PROT_READ, MAP_PRIVATE, t.fd, 0);
+  TEST_ASSERT_TRUE_MESSAGE(p != MAP_FAILED, path.c_str());
+  madvise(p, t.size, MADV_SEQUENTIAL);
+
+  t.header = (const trace_header *)p;
+  t.frames = (const trace_frame *)(t.header + 1);
+  TEST_ASSERT_EQUAL_MEMORY_MESSAGE(TRACE_MAGIC, t.header->magic, 4, path.c_str());
+  TEST_ASSERT_EQUAL_MESSAGE(TRACE_VERSION, t.header->version, path.c_str());
+  TEST_ASSERT_TRUE_MESSAGE(t.header->frame_count > 0, path.c_str());
+  TEST_ASSERT_TRUE_MESSAGE(sizeof(trace_header) + (size_t)t.header->frame_count * sizeof(trace_frame) <= t.size, path.c_str());
+
+  traces.push_back(t);
+}
+
+static void load_traces(const char *dir)
+{
+  DIR *d = opendir(dir);
+  TEST_ASSERT_NOT_NULL_MESSAGE(d, dir);
+  std::vector<std::string> names;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL)
+  {
+    std::string name = e->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".trc") == 0) {
+      names.push_back(name);
+    }
+  }
+  closedir(d);
+  TEST_ASSERT_TRUE_MESSAGE(!names.empty(), "no *.trc traces found");
+  std::sort(names.begin(), names.end());
+
+  for (size_t i = 0; i < names.size(); i++)
+  {
+    map_trace(std::string(dir) + "/" + names[i], names[i].substr(0, names[i].size() - 4));
+  }
+}
+
+static void unload_traces()
+{
+  for (size_t i = 0; i < traces.size(); i++)
+  {
+    munmap((void *)traces[i].header, traces[i].size);
+    close(traces[i].fd);
+  }
+  traces.clear();
+
+  if (!synth_dir.empty()) {
+    for (size_t i = 0; i < sizeof(synth_specs) / sizeof(synth_specs[0]); i++)
+    {
+      unlink((synth_dir + "/" + synth_specs[i].name + ".trc").c_str());
+    }
+    rmdir(synth_dir.c_str());
+    synth_dir.clear();
+  }
+}
+
+
+// Checks
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Frames/second recorded by an earlier run on this machine, 0 if there is none
+static double read_bench_baseline(const char *path)
+{
+  double frames_per_second = 0;
+  FILE *f = fopen(path, "r");
+  if (f != NULL) {
+    if (fscanf(f, "%lf", &frames_per_second) != 1) {
+      frames_per_second = 0;
+    }
+    fclose(f);
+  }
+  return frames_per_second;
+}
+
+static void write_bench_baseline(const char *path, double frames_per_second)
+{
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    printf("Can't record the baseline in %s\n", path);
+    return;
+  }
+  fprintf(f, "%.0f\n", frames_per_second);
+  fclose(f);
+  printf("Recorded %.0f frames/s as the baseline in %s\n", frames_per_second, path);
+}
+
+// Returns the number of frames whose verdict doesn't match the trace header
+static uint32_t check_verdict(const mapped_trace &t, const measurement &m, uint32_t frame)
+{
+  const trace_header &h = *t.header;
+  // Socket occupancy is decided the way the firmware does it, with no relay path known to be dead
+  bool present = socket_occupied(m.counts, 0);
+  bool ok = m.pass == (bool)h.expected_pass && m.model == h.expected_model && present == (bool)h.expected_present;
+  for (int i = 0; i < NUM_DUT_RESISTORS; i++)
+  {
+    ok = ok && m.state[i] == h.expected_state[i];
+  }
+  if (!ok) {
+    printf("  %s frame %u: pass=%d model=%d present=%d, expected pass=%d model=%d present=%d\n",
+      t.name.c_str(), frame, m.pass, m.model, present, h.expected_pass, h.expected_model, h.expected_present);
+  }
+  return ok ? 0 : 1;
+}
+
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+
+// Run the whole pipeline over every trace, frame by frame, and check each verdict
+void test_pipeline_throughput_and_verdicts()
+{
+  uint64_t total_frames = 0;
+  double total_seconds = 0;
+
+  printf("\n%-20s %10s %12s %10s\n", "trace", "frames", "frames/s", "ns/frame");
+  for (size_t i = 0; i < traces.size(); i++)
+  {
+    const mapped_trace &t = traces[i];
+    uint32_t frame_count = t.header->frame_count;
+    uint32_t passes = (REPLAY_FRAMES + frame_count - 1) / frame_count;
+    uint32_t mismatches = 0;
+    measurement m;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t pass = 0; pass < passes; pass++)
+    {
+      for (uint32_t n = 0; n < frame_count; n++)
+      {
+        evaluate_measurement(t.frames[n].counts, t.frames[n].temperature, m);
+        if (m.pass != (bool)t.header->expected_pass || m.model != t.header->expected_model) {
+          mismatches += check_verdict(t, m, n);
+        }
+      }
+    }
+    double seconds = seconds_since(start);
+
+    // The loop above only looks at the headline verdict so it stays cheap; check everything once
+    for (uint32_t n = 0; n < frame_count; n++)
+    {
+      evaluate_measurement(t.frames[n].counts, t.frames[n].temperature, m);
+      mismatches += check_verdict(t, m, n);
+    }
+
+    uint64_t frames = (uint64_t)passes * frame_count;
+    total_frames += frames;
+    total_seconds += seconds;
+    printf("%-20s %10llu %12.0f %10.1f\n", t.name.c_str(), (unsigned long long)frames, frames / seconds, seconds * 1e9 / frames);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, mismatches, t.name.c_str());
+  }
+
+  double frames_per_second = total_frames / total_seconds;
+  printf("%-20s %10llu %12.0f %10.1f\n", "all", (unsigned long long)total_frames, frames_per_second, total_seconds * 1e9 / total_frames);
+  TEST_ASSERT_TRUE_MESSAGE(frames_per_second >= MIN_FRAMES_PER_SECOND, "pipeline slower than MIN_FRAMES_PER_SECOND");
+
+  // Compare against this machine's own baseline, or record one
+  const char *baseline_path = getenv("ANALOG_CAL_BENCH_BASELINE");
+  if (baseline_path == NULL) {
+    baseline_path = BENCH_BASELINE_FILE;
+  }
+  const char *record = getenv("ANALOG_CAL_BENCH_RECORD");
+  double baseline = (record != NULL && strcmp(record, "0") != 0) ? 0 : read_bench_baseline(baseline_path);
+  if (baseline <= 0) {
+    write_bench_baseline(baseline_path, frames_per_second);
+    return;
+  }
+  printf("%-20s %10s %12.0f %9.1f%%\n", "baseline", "", baseline, 100.0 * (frames_per_second / baseline - 1));
+  TEST_ASSERT_TRUE_MESSAGE(frames_per_second >= baseline * (1 - BENCH_TOLERANCE), "pipeline slower than the recorded baseline");
+}
+
+
+// Time each stage on its own by running it over a batch of frames at a time
+void test_stage_cost()
+{
+  static measurement batch[BATCH_FRAMES];
+  double stage_seconds[STAGE_COUNT] = { 0 };
+  uint64_t total_frames = 0;
+  uint32_t mismatches = 0;
+
+  for (size_t i = 0; i < traces.size(); i++)
+  {
+    const mapped_trace &t = traces[i];
+    uint32_t frame_count = t.header->frame_count;
+    uint32_t passes = (REPLAY_FRAMES + frame_count - 1) / frame_count;
+
+    for (uint32_t pass = 0; pass < passes; pass++)
+    {
+      for (uint32_t first = 0; first < frame_count; first += BATCH_FRAMES)
+      {
+        uint32_t count = frame_count - first < BATCH_FRAMES ? frame_count - first : BATCH_FRAMES;
+        const trace_frame *frames = t.frames + first;
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t n = 0; n < count; n++)
+        {
+          batch[n].TEMP = frames[n].temperature;
+          compute_resistances(frames[n].counts, batch[n]);
+        }
+        stage_seconds[STAGE_RESISTANCE] += seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        for (uint32_t n = 0; n < count; n++)
+        {
+          detect_open_short(batch[n]);
+        }
+        stage_seconds[STAGE_OPEN_SHORT] += seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        for (uint32_t n = 0; n < count; n++)
+        {
+          classify_model(batch[n]);
+        }
+        stage_seconds[STAGE_MODEL] += seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        for (uint32_t n = 0; n < count; n++)
+        {
+          check_tolerance(batch[n]);
+        }
+        stage_seconds[STAGE_TOLERANCE] += seconds_since(start);
+
+        // Running the stages separately has to give the same answer as evaluate_measurement()
+        if (pass == 0) {
+          for (uint32_t n = 0; n < count; n++)
+          {
+            mismatches += check_verdict(t, batch[n], first + n);
+          }
+        }
+        total_frames += count;
+      }
+    }
+  }
+
+  printf("\n%-20s %10s %10s\n", "stage", "ns/frame", "share");
+  double total_seconds = 0;
+  for (int s = 0; s < STAGE_COUNT; s++)
+  {
+    total_seconds += stage_seconds[s];
+  }
+  for (int s = 0; s < STAGE_COUNT; s++)
+  {
+    printf("%-20s %10.2f %9.1f%%\n", stage_names[s], stage_seconds[s] * 1e9 / total_frames, 100.0 * stage_seconds[s] / total_seconds);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, mismatches);
+}
+
+
+// Synthesize the traces unless ANALOG_CAL_TRACE_DIR points at recorded ones, then map them
+void test_load_traces()
+{
+  const char *trace_dir = getenv("ANALOG_CAL_TRACE_DIR");
+  if (trace_dir == NULL) {
+    char dir_template[] = "/tmp/analog_cal_traces_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir_template));
+    synth_dir = dir_template;
+    for (size_t i = 0; i < sizeof(synth_specs) / sizeof(synth_specs[0]); i++)
+    {
+      synthesize_trace(synth_specs[i], (synth_dir + "/" + synth_specs[i].name + ".trc").c_str());
+    }
+    trace_dir = synth_dir.c_str();
+  }
+  load_traces(trace_dir);
+}
+
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_load_traces);
+  if (!traces.empty()) {
+    RUN_TEST(test_pipeline_throughput_and_verdicts);
+    RUN_TEST(test_stage_cost);
+  }
+  unload_traces();
+  return UNITY_END();
+}